@@ -0,0 +1,163 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "../include/vm.h"
+#include "../include/batch.h"
+
+#define LANES      256
+#define ITERATIONS 2000
+#define R(n)       (MODULO + (n))
+
+// NOTE: a sweep over r7 with every vectorized op and one data dependent branch, r5 collects the branch count
+static const uint16_t sweep_program[] = {
+    1, R(0), 1,                 //  0: set r0 1
+    1, R(1), ITERATIONS,        //  3: set r1 ITERATIONS
+    10, R(0), R(0), R(7),       //  6: mult r0 r0 r7
+    9, R(0), R(0), 12345,       // 10: add r0 r0 12345
+    11, R(2), R(0), 7,          // 14: mod r2 r0 7
+    4, R(3), R(2), 3,           // 18: eq r3 r2 3
+    8, R(3), 29,                // 22: jf r3 29
+    9, R(5), R(5), 1,           // 25: add r5 r5 1
+    12, R(4), R(0), R(7),       // 29: and r4 r0 r7
+    13, R(4), R(4), 4096,       // 33: or r4 r4 4096
+    14, R(6), R(4),             // 37: not r6 r4
+    5, R(3), R(6), R(0),        // 40: gt r3 r6 r0
+    9, R(6), R(6), R(3),        // 44: add r6 r6 r3
+    9, R(1), R(1), 32767,       // 48: add r1 r1 32767 (r1 - 1)
+    7, R(1), 6,                 // 52: jt r1 6
+    0,                          // 55: halt
+};
+
+// NOTE: every lane patches the literal of the add with its own r7, then the lanes meet again on the noops
+static const uint16_t smc_program[] = {
+    1, R(0), 0,                 //  0: set r0 0
+    16, 13, R(7),               //  3: wmem 13 r7
+    21, 21, 21, 21,             //  6: noop x4
+    9, R(0), R(0), 0,           // 10: add r0 r0 <patched>
+    0,                          // 14: halt
+};
+
+// NOTE: only the odd lanes patch the literal of the add, all with the same value, then every lane meets on the noops
+static const uint16_t smc_group_program[] = {
+    1, R(1), 0,                 //  0: set r1 0
+    12, R(2), R(7), 1,          //  3: and r2 r7 1
+    8, R(2), 13,                //  7: jf r2 13
+    16, 21, 5,                  // 10: wmem 21 5
+    21, 21, 21, 21, 21,         // 13: noop x5
+    9, R(1), R(1), 100,         // 18: add r1 r1 <100, patched to 5 on odd lanes>
+    0,                          // 22: halt
+};
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static VM *make_image(const char *binary, const uint16_t *program, size_t size) {
+    VM *vm = vm_init(false);
+    if (vm == NULL) {
+        return NULL;
+    }
+    if (binary != NULL) {
+        vm_load_binary(vm, binary);
+    } else {
+        memcpy(vm->mem, program, size);
+    }
+    return vm;
+}
+
+// NOTE: reference run, every lane as its own VM, stopping at the first *in* like the batch does without on_in
+static double run_scalar(VM *image, VM **out, bool sweep) {
+    double start = now_sec();
+    for (int i = 0; i < LANES; i++) {
+        VM *vm = out[i];
+        memcpy(vm->mem, image->mem, sizeof(vm->mem));
+        vm->regs[7] = sweep ? (uint16_t)i : 0;
+        while (vm->status == VM_OK && !vm->halt && vm->pos < MEM_SIZE) {
+            uint16_t op = vm->mem[vm->pos];
+            if (op == 20) {
+                vm->halt = true;
+            } else if (op == 19) {
+                vm->pos += 2; // NOTE: output is discarded on both sides
+            } else {
+                vm_next_inst(vm);
+            }
+        }
+    }
+    return now_sec() - start;
+}
+
+static int compare(VmBatch *batch, VM **ref) {
+    vm_batch_sync(batch);
+    int bad = 0;
+    for (int i = 0; i < LANES; i++) {
+        VM *a = batch->vms[i], *b = ref[i];
+        if (a->pos != b->pos || memcmp(a->regs, b->regs, sizeof(a->regs)) != 0 || memcmp(a->mem, b->mem, sizeof(a->mem)) != 0) {
+            bad++;
+        }
+    }
+    return bad;
+}
+
+static int bench(const char *name, const char *binary, const uint16_t *program, size_t size, bool sweep) {
+    VM *image = make_image(binary, program, size);
+    VM *ref[LANES];
+    for (int i = 0; i < LANES; i++) {
+        ref[i] = vm_init(false);
+        if (ref[i] == NULL || image == NULL || image->status != VM_OK) {
+            printf("%s: setup failed\n", name);
+            return 1;
+        }
+    }
+
+    double scalar = run_scalar(image, ref, sweep);
+    printf("%s (%d lanes)\n", name, LANES);
+    printf("  %-7s: %8.3f ms\n", "vm", scalar * 1e3);
+
+    int failures = 0;
+    BatchIsa isas[] = {BATCH_ISA_SCALAR, BATCH_ISA_SSE2, BATCH_ISA_AVX2};
+    for (size_t k = 0; k < sizeof(isas) / sizeof(isas[0]); k++) {
+        VmBatch *batch = vm_batch_init(LANES, isas[k]);
+        if (batch == NULL) {
+            printf("  %-7s: not supported on this cpu\n", vm_batch_isa_name(isas[k]));
+            continue;
+        }
+
+        vm_batch_load(batch, image);
+        for (int i = 0; i < LANES; i++) {
+            batch->regs[7][i] = sweep ? (uint16_t)i : 0;
+        }
+
+        double start = now_sec();
+        vm_batch_run(batch, UINT64_MAX);
+        double secs = now_sec() - start;
+
+        int bad = compare(batch, ref);
+        failures += bad;
+        printf("  %-7s: %8.3f ms, vector steps: %llu, scalar steps: %llu, mismatching lanes: %d\n",
+               vm_batch_isa_name(isas[k]), secs * 1e3, (unsigned long long)batch->vector_steps,
+               (unsigned long long)batch->scalar_steps, bad);
+        vm_batch_free(batch);
+    }
+
+    for (int i = 0; i < LANES; i++) {
+        vm_free(ref[i]);
+    }
+    vm_free(image);
+    return failures;
+}
+
+int main() {
+    printf("detected isa: %s\n", vm_batch_isa_name(vm_batch_detect_isa()));
+    int failures = bench("r7 sweep", NULL, sweep_program, sizeof(sweep_program), true);
+    failures += bench("self-modifying code, r7 sweep", NULL, smc_program, sizeof(smc_program), true);
+    failures += bench("self-modifying code in half the lanes", NULL, smc_group_program, sizeof(smc_group_program), true);
+    failures += bench("challenge.bin boot, r7 sweep", "../data/challenge.bin", NULL, 0, true);
+    failures += bench("challenge.bin boot, identical lanes", "../data/challenge.bin", NULL, 0, false);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,140 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "../include/vm.h"
+
+#define OPERAND_COUNT (1 << 20)
+#define ROUNDS        64
+
+// NOTE: the branchy decoder vm_get_num used before the branchless select, kept here as the baseline
+static uint16_t legacy_regs[REG_COUNT];
+
+static uint16_t legacy_get_reg(uint16_t n) {
+    if (n < 32768 || n > 32775) {
+        return NO_REG;
+    }
+    return n % MODULO;
+}
+
+static uint16_t legacy_get_num(uint16_t n) {
+    uint16_t reg = legacy_get_reg(n);
+    if (n > 32767) {
+        if (reg == NO_REG) {
+            return NO_NUM;
+        }
+        return legacy_regs[reg];
+    }
+    return n;
+}
+
+static int perf_open_branch_misses() {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type           = PERF_TYPE_HARDWARE;
+    attr.size           = sizeof(attr);
+    attr.config         = PERF_COUNT_HW_BRANCH_MISSES;
+    attr.disabled       = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+typedef struct {
+    double   secs;
+    long long misses;
+    uint32_t sum;
+} BenchResult;
+
+static BenchResult run(int fd, const uint16_t *operands, VM *vm) {
+    BenchResult r = {0};
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    double start = now_sec();
+    uint32_t sum = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        if (vm == NULL) {
+            for (int i = 0; i < OPERAND_COUNT; i++) {
+                sum += legacy_get_num(operands[i]);
+            }
+        } else {
+            for (int i = 0; i < OPERAND_COUNT; i++) {
+                sum += vm_get_num(vm, operands[i]);
+            }
+        }
+    }
+    r.secs = now_sec() - start;
+
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &r.misses, sizeof(r.misses)) != sizeof(r.misses)) {
+            r.misses = -1;
+        }
+    } else {
+        r.misses = -1;
+    }
+
+    r.sum = sum;
+    return r;
+}
+
+int main() {
+    VM *vm = vm_init(false);
+    if (vm == NULL) {
+        printf("virtual machine initialization is fail\n");
+        return 1;
+    }
+
+    // NOTE: roughly half registers and half literals in random order, that is what hurts the old decoder
+    uint16_t *operands = malloc(sizeof(uint16_t) * OPERAND_COUNT);
+    if (operands == NULL) {
+        vm_free(vm);
+        return 1;
+    }
+
+    srand(42);
+    for (int i = 0; i < REG_COUNT; i++) {
+        legacy_regs[i] = (uint16_t)(i * 7);
+        vm->regs[i]    = (uint16_t)(i * 7);
+    }
+    for (int i = 0; i < OPERAND_COUNT; i++) {
+        operands[i] = (rand() & 1) ? (uint16_t)(MODULO + rand() % REG_COUNT) : (uint16_t)(rand() % MODULO);
+    }
+
+    int fd = perf_open_branch_misses();
+    if (fd < 0) {
+        printf("perf_event_open is not available, only timings are reported\n");
+    }
+
+    BenchResult legacy = run(fd, operands, NULL);
+    BenchResult branchless = run(fd, operands, vm);
+
+    printf("decoded %d operands per variant\n", OPERAND_COUNT * ROUNDS);
+    printf("legacy : %8.3f ms, branch misses: %lld\n", legacy.secs * 1e3, legacy.misses);
+    printf("select : %8.3f ms, branch misses: %lld\n", branchless.secs * 1e3, branchless.misses);
+    if (legacy.sum != branchless.sum) {
+        printf("checksum mismatch: %u != %u\n", legacy.sum, branchless.sum);
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(operands);
+    vm_free(vm);
+    return legacy.sum == branchless.sum ? 0 : 1;
+}
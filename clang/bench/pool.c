@@ -0,0 +1,144 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../include/vm.h"
+#include "../include/pool.h"
+
+#define BINARY_PATH "../data/challenge.bin"
+#define SESSIONS    20000
+#define LIVE        256
+#define SESSION_RUN 10000 // NOTE: instructions each session runs before it is closed
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// NOTE: proportional set size, pages shared between the cow slots are only counted once
+static long rss_bytes() {
+    char line[256];
+    long kib = 0;
+    FILE *fp = fopen("/proc/self/smaps_rollup", "r");
+    if (fp == NULL) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "Pss: %ld kB", &kib) == 1) {
+            break;
+        }
+    }
+    fclose(fp);
+    return kib * 1024;
+}
+
+// NOTE: output is skipped and the first *in* ends the session
+static void run(VM *vm, int steps) {
+    for (int i = 0; i < steps && vm->status == VM_OK && !vm->halt && vm->mem[vm->pos] != 20; i++) {
+        if (vm->mem[vm->pos] == 19) {
+            vm->pos += 2;
+        } else {
+            vm_next_inst(vm);
+        }
+    }
+}
+
+// NOTE: the pre-pool way, every session mallocs a VM and reloads the binary
+static VM *fresh_session() {
+    VM *vm = vm_init(false);
+    if (vm != NULL) {
+        vm_load_binary(vm, BINARY_PATH);
+    }
+    return vm;
+}
+
+static void bench_fresh(int steps) {
+    double start = now_sec();
+    for (int i = 0; i < SESSIONS; i++) {
+        VM *vm = fresh_session();
+        run(vm, steps);
+        vm_free(vm);
+    }
+    double secs = now_sec() - start;
+    printf("  %-14s: %9.0f sessions/s\n", "vm_init+load", SESSIONS / secs);
+}
+
+static void bench_pool(VM *image, PoolMode mode, int steps) {
+    VmPool *pool = vm_pool_init(image, LIVE, mode);
+    if (pool == NULL) {
+        printf("  pool %-9s: not available\n", vm_pool_mode_name(mode));
+        return;
+    }
+
+    double start = now_sec();
+    for (int i = 0; i < SESSIONS; i++) {
+        VM *vm = vm_pool_acquire(pool);
+        run(vm, steps);
+        vm_pool_release(pool, vm);
+    }
+    double secs = now_sec() - start;
+    printf("  pool %-9s: %9.0f sessions/s%s\n", vm_pool_mode_name(mode), SESSIONS / secs, pool->huge ? " (huge pages)" : "");
+    vm_pool_free(pool);
+}
+
+static void rss_fresh() {
+    VM *live[LIVE];
+    long before = rss_bytes();
+    for (int i = 0; i < LIVE; i++) {
+        live[i] = fresh_session();
+        run(live[i], SESSION_RUN);
+    }
+    long after = rss_bytes();
+    printf("  %-14s: %7ld KiB per instance\n", "vm_init+load", (after - before) / LIVE / 1024);
+    for (int i = 0; i < LIVE; i++) {
+        vm_free(live[i]);
+    }
+}
+
+static void rss_pool(VM *image, PoolMode mode) {
+    VM *live[LIVE];
+    long before = rss_bytes();
+    VmPool *pool = vm_pool_init(image, LIVE, mode);
+    if (pool == NULL) {
+        printf("  pool %-9s: not available\n", vm_pool_mode_name(mode));
+        return;
+    }
+    for (int i = 0; i < LIVE; i++) {
+        live[i] = vm_pool_acquire(pool);
+        run(live[i], SESSION_RUN);
+    }
+    long after = rss_bytes();
+    printf("  pool %-9s: %7ld KiB per instance\n", vm_pool_mode_name(mode), (after - before) / LIVE / 1024);
+    for (int i = 0; i < LIVE; i++) {
+        vm_pool_release(pool, live[i]);
+    }
+    vm_pool_free(pool);
+}
+
+int main() {
+    VM *image = fresh_session();
+    if (image == NULL || image->status != VM_OK) {
+        printf("cannot load %s\n", BINARY_PATH);
+        return 1;
+    }
+
+    int runs[] = {0, SESSION_RUN};
+    for (size_t r = 0; r < sizeof(runs) / sizeof(runs[0]); r++) {
+        printf("session create + %d instructions + close (%d sessions)\n", runs[r], SESSIONS);
+        bench_fresh(runs[r]);
+        bench_pool(image, POOL_COPY, runs[r]);
+        bench_pool(image, POOL_COW, runs[r]);
+    }
+
+    printf("resident memory (pss), %d live sessions after %d instructions each\n", LIVE, SESSION_RUN);
+    rss_fresh();
+    rss_pool(image, POOL_COPY);
+    rss_pool(image, POOL_COW);
+
+    vm_free(image);
+    return 0;
+}
@@ -6,6 +6,14 @@ cc="gcc"
 flags="-std=c17 -ggdb -Wall -Werror -Wextra -Wswitch"
 src="src"
 bin="bin"
+bench="bench"
 
 $cc $flags -o $bin/main $src/main.c $src/vm/*.c
+$cc $flags -o $bin/vmstat $src/vmstat.c $src/vm/*.c
+$cc $flags -O2 -o $bin/bench_operands $bench/operands.c $src/vm/*.c
+$cc $flags -O2 -o $bin/bench_batch $bench/batch.c $src/vm/*.c
+$cc $flags -O2 -o $bin/bench_pool $bench/pool.c $src/vm/*.c
 # ./$bin/main
+# ./$bin/bench_operands
+# ./$bin/bench_batch
+# ./$bin/bench_pool
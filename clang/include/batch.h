@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "vm.h"
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#define BATCH_LANE_ALIGN 16 // NOTE: one AVX2 register of uint16_t, lane arrays are padded to this
+
+#define BATCH_ISA_LIST(X) \
+    X(BATCH_ISA_AUTO, "auto") \
+    X(BATCH_ISA_SCALAR, "scalar") \
+    X(BATCH_ISA_SSE2, "sse2") \
+    X(BATCH_ISA_AVX2, "avx2")
+
+typedef enum {
+#define X(name, value) name,
+    BATCH_ISA_LIST(X)
+#undef X
+} BatchIsa;
+
+typedef void (*BatchOutFn)(int lane, uint16_t ch, void *ctx);
+typedef int  (*BatchInFn)(int lane, void *ctx); // NOTE: return -1 to halt the lane
+
+// NOTE: K machines running the same guest, registers and *pos* are struct-of-arrays (regs[r][lane]) while
+//       memory, stack and status stay in one VM per lane; lanes sharing *pos* and code run as one group
+typedef struct {
+    int        count;
+    int        lanes;             // NOTE: count rounded up to BATCH_LANE_ALIGN
+    BatchIsa   isa;
+    VM         **vms;
+    uint16_t   *regs[REG_COUNT];
+    uint16_t   *pos;
+    uint16_t   *mask;             // NOTE: 0xffff for lanes in the current group
+    uint16_t   *lit[2];           // NOTE: literal operands broadcast over all lanes
+    uint8_t    *dirty;            // NOTE: bit per word some lane wrote on its own, code there may differ between lanes
+    uint8_t    *wait;             // NOTE: bit per pos another lane waits at while one lane runs alone
+    int32_t    lit_val[2];        // NOTE: value currently held by each *lit* row, -1 for none
+    BatchOutFn on_out;            // NOTE: NULL discards output
+    BatchInFn  on_in;             // NOTE: NULL halts a lane on its first *in*
+    void       *ctx;
+    uint64_t   vector_steps;      // NOTE: instructions run once for a whole group
+    uint64_t   scalar_steps;      // NOTE: single lane instructions run through vm_next_inst
+} VmBatch;
+
+const char *vm_batch_isa_name(BatchIsa isa);
+BatchIsa vm_batch_detect_isa();
+VmBatch *vm_batch_init(int count, BatchIsa isa);
+void vm_batch_free(VmBatch *batch);
+bool vm_batch_load(VmBatch *batch, VM *image);
+bool vm_batch_active(VmBatch *batch, int lane);
+uint64_t vm_batch_run(VmBatch *batch, uint64_t max_steps);
+void vm_batch_sync(VmBatch *batch);
+
+#endif
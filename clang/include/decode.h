@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "vm.h"
+
+#ifndef _DECODE_H_
+#define _DECODE_H_
+
+#define DECODE_CACHE_MAGIC   "SYNDECO"
+#define DECODE_CACHE_VERSION 1
+#define DECODE_NONE          0xffff // NOTE: address not decoded yet
+#define DECODE_SLOW          0xfffe // NOTE: decoded, but has to go through vm_next_inst
+#define DECODE_NO_BLOCK      -1
+
+#define DECODE_STATE_LIST(X) \
+    X(DECODE_OK, "decode cache is ok") \
+    X(DECODE_OPEN_ERROR, "cannot open the decode cache file") \
+    X(DECODE_WRITE_ERROR, "writing the decode cache file has failed") \
+    X(DECODE_MAP_ERROR, "mapping the decode cache file has failed") \
+    X(DECODE_BAD_HEADER_ERROR, "decode cache header is invalid or from another version") \
+    X(DECODE_BINARY_MISMATCH_ERROR, "decode cache was built for a different binary") \
+    X(DECODE_ALLOCATION_FAIL_ERROR, "memory allocation in decode has failed")
+
+typedef enum {
+#define X(name, value) name,
+    DECODE_STATE_LIST(X)
+#undef X
+} DecodeStatus;
+
+// NOTE: *op* is the opcode for the ops vm_next_decoded runs itself, their operands were checked when decoding so
+//       register args hold a register index and number args the raw word (below NUM_END)
+typedef struct {
+    uint16_t op;
+    uint16_t args[3];
+} DecodedInst;
+
+// NOTE: straight line code from *start* up to and including the first control flow instruction
+typedef struct {
+    uint16_t start;
+    uint16_t words;
+    uint32_t first_inst;  // NOTE: index of its first record in the cache file's record array
+    uint32_t inst_count;
+    uint32_t reserved;
+    uint64_t hash;        // NOTE: vm_hash_mem of mem[start..start+words) when the block was decoded
+} DecodedBlock;
+
+// NOTE: the file is this header, then *block_count* DecodedBlock, then *inst_count* DecodedInst
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t binary_hash;
+    uint32_t block_count;
+    uint32_t inst_count;
+} DecodeCacheHeader;
+
+typedef struct VmDecoded {
+    DecodedInst  insts[MEM_SIZE];
+    int32_t      block_at[MEM_SIZE];  // NOTE: live block covering each word, DECODE_NO_BLOCK for none
+    int32_t      pending[MEM_SIZE];   // NOTE: cached block starting at each address, not checked against mem yet
+    DecodedBlock *blocks;             // NOTE: live blocks, dead ones have words == 0
+    uint32_t     block_count;
+    uint32_t     block_cap;
+    const uint8_t *cache;             // NOTE: mmap of the cache file the pending blocks come from
+    size_t       cache_size;
+    uint64_t     decoded;             // NOTE: blocks decoded from memory
+    uint64_t     installed;           // NOTE: blocks taken from the cache after their hash matched
+    uint64_t     stale;               // NOTE: cached blocks dropped because mem no longer matched
+    uint64_t     invalidated;         // NOTE: live blocks dropped because the guest wrote into them
+} VmDecoded;
+
+const char *decode_get_error_msg(DecodeStatus status);
+bool vm_decoded_attach(VM *vm);
+void vm_decoded_detach(VM *vm);
+void vm_decoded_invalidate(VM *vm, uint16_t addr);
+uint32_t vm_run_decoded(VM *vm, uint32_t max_steps);
+DecodeStatus decode_cache_load(VM *vm, const char *path, uint64_t binary_hash);
+DecodeStatus decode_cache_save(VM *vm, const char *path, uint64_t binary_hash);
+void vm_decoded_print_stats(VM *vm, FILE *fp);
+
+#endif
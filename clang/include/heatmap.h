@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "vm.h"
+
+#ifndef _HEATMAP_H_
+#define _HEATMAP_H_
+
+#define HEATMAP_MAGIC   "SYNHEAT"
+#define HEATMAP_VERSION 2
+#define HEATMAP_TOP     16 // NOTE: hottest addresses listed in the report
+
+#define HEATMAP_STATE_LIST(X) \
+    X(HEATMAP_OK, "heatmap is ok") \
+    X(HEATMAP_OPEN_ERROR, "cannot open the heatmap file") \
+    X(HEATMAP_WRITE_ERROR, "writing the heatmap file has failed") \
+    X(HEATMAP_READ_ERROR, "reading the heatmap file has failed") \
+    X(HEATMAP_BAD_HEADER_ERROR, "heatmap header is invalid or from another version")
+
+typedef enum {
+#define X(name, value) name,
+    HEATMAP_STATE_LIST(X)
+#undef X
+} HeatmapStatus;
+
+#define HEATMAP_FLAG_LIST(X) \
+    X(HEATMAP_EXEC, "executed") \
+    X(HEATMAP_READ, "read") \
+    X(HEATMAP_WRITE, "written") \
+    X(HEATMAP_WRITE_EXEC, "written then executed") \
+    X(HEATMAP_INST_START, "instruction start")
+
+typedef enum {
+#define X(name, value) name,
+    HEATMAP_FLAG_LIST(X)
+#undef X
+    HEATMAP_FLAG_COUNT
+} HeatmapFlag;
+
+// NOTE: one bit per word for every flag, one saturating counter per word for exec, read and write,
+//       exec marks every word of an executed instruction but only counts on its opcode word, which is also
+//       the only word marked as an instruction start
+typedef struct VmHeatmap {
+    uint8_t  bits[HEATMAP_FLAG_COUNT][MEM_SIZE / 8];
+    uint32_t counts[HEATMAP_WRITE_EXEC][MEM_SIZE];
+} VmHeatmap;
+
+// NOTE: the map file is this header followed by *bits* and then *counts*, both exactly as laid out in VmHeatmap
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t mem_words;
+    uint32_t flag_count;
+    uint32_t bits_offset;
+    uint32_t counts_offset;
+} HeatmapHeader;
+
+static inline bool heatmap_has(const VmHeatmap *map, HeatmapFlag flag, uint16_t addr) {
+    return (map->bits[flag][addr / 8] >> (addr % 8)) & 1;
+}
+
+static inline void heatmap_mark(VmHeatmap *map, HeatmapFlag flag, uint16_t addr) {
+    map->bits[flag][addr / 8] |= (uint8_t)(1 << (addr % 8));
+    if (flag < HEATMAP_WRITE_EXEC && map->counts[flag][addr] != UINT32_MAX) {
+        map->counts[flag][addr]++;
+    }
+}
+
+static inline void heatmap_record_exec(VmHeatmap *map, uint16_t addr, uint16_t words) {
+    heatmap_mark(map, HEATMAP_EXEC, addr);
+    heatmap_mark(map, HEATMAP_INST_START, addr);
+    for (uint32_t i = addr; i < (uint32_t)addr + words && i < MEM_SIZE; i++) {
+        map->bits[HEATMAP_EXEC][i / 8] |= (uint8_t)(1 << (i % 8));
+        if (heatmap_has(map, HEATMAP_WRITE, (uint16_t)i)) {
+            heatmap_mark(map, HEATMAP_WRITE_EXEC, (uint16_t)i);
+        }
+    }
+}
+
+const char *heatmap_get_error_msg(HeatmapStatus status);
+bool vm_heatmap_attach(VM *vm);
+void vm_heatmap_detach(VM *vm);
+HeatmapStatus heatmap_save(const VmHeatmap *map, const char *path);
+HeatmapStatus heatmap_load(VmHeatmap *map, const char *path);
+void heatmap_report(const VmHeatmap *map, FILE *fp);
+
+#endif
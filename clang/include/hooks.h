@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "vm.h"
+
+#ifndef _HOOKS_H_
+#define _HOOKS_H_
+
+#define HOOK_MAX_RANGES 3
+#define HOOK_CHECK_STEP_LIMIT 10000000 // NOTE: interpreted reference run gives up after this many instructions
+
+// NOTE: name, call target, FNV-1a 64 (vm_hash_mem) of the ranges below as found in challenge.bin
+#define HOOK_LIST(X) \
+    X(HOOK_FOREACH, "foreach", 1458, 0x6f27360f5fc496efULL) \
+    X(HOOK_PRINT,   "print",   1518, 0xbdf743b1530f570fULL) \
+    X(HOOK_DECRYPT, "decrypt", 1723, 0xcb5657bccc4ecc85ULL) \
+    X(HOOK_XOR,     "xor",     2125, 0x5f2d667ed7ad76acULL)
+
+typedef enum {
+#define X(name, label, target, hash) name,
+    HOOK_LIST(X)
+#undef X
+    HOOK_COUNT
+} HookId;
+
+typedef struct {
+    uint16_t start;
+    uint16_t end;
+} HookRange;
+
+typedef struct VmHooks {
+    bool     check;                   // NOTE: run every hooked call both ways and compare before trusting the native result
+    bool     dirty;                   // NOTE: a guarded word was written, hashes are verified again on the next hooked call
+    bool     enabled[HOOK_COUNT];
+    uint64_t native_calls[HOOK_COUNT];
+    uint8_t  slot[MEM_SIZE];          // NOTE: call target -> HookId + 1, 0 means no hook
+    uint8_t  guard[MEM_SIZE / 8];     // NOTE: bitmap of words covered by an enabled hook
+    FILE     *out;                    // NOTE: where native *out* goes, NULL means stdout
+    VM       *shadow[2];              // NOTE: scratch machines for the check mode
+} VmHooks;
+
+bool vm_hooks_attach(VM *vm, bool check);
+void vm_hooks_detach(VM *vm);
+bool vm_hooks_call(VM *vm, uint16_t target);
+void vm_hooks_guard_write(VM *vm, uint16_t addr);
+void vm_hooks_print_stats(VM *vm, FILE *fp);
+
+#endif
@@ -0,0 +1,41 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "vm.h"
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#define METRICS_MAGIC        "SYNMETR"
+#define METRICS_VERSION      1
+#define METRICS_PUBLISH_MASK 0xffff // NOTE: vm_process publishes the instruction count once per 65536 instructions
+
+// NOTE: one writer (the vm) and any number of readers mapping the same file, every counter is a relaxed atomic so
+//       neither side ever takes a lock, times are CLOCK_MONOTONIC nanoseconds
+typedef struct VmMetrics {
+    char             magic[8];
+    uint32_t         version;
+    uint32_t         pid;
+    _Atomic uint64_t started_ns;
+    _Atomic uint64_t updated_ns;
+    _Atomic uint64_t instructions;
+    _Atomic uint64_t stack_depth;
+    _Atomic uint64_t stack_peak;
+    _Atomic uint64_t in_bytes;
+    _Atomic uint64_t out_bytes;
+    _Atomic uint64_t in_blocked_ns;
+    _Atomic uint32_t running;
+} VmMetrics;
+
+uint64_t metrics_now_ns();
+bool vm_metrics_attach(VM *vm, const char *path);
+void vm_metrics_detach(VM *vm);
+void vm_metrics_publish(VM *vm, uint64_t instructions);
+void vm_metrics_count_in(VM *vm, uint64_t blocked_since_ns, bool got);
+void vm_metrics_count_out(VM *vm);
+VmMetrics *metrics_open(const char *path);
+void metrics_close(VmMetrics *metrics);
+
+#endif
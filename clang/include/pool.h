@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "vm.h"
+
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#define POOL_HUGE_PAGE (2 * 1024 * 1024)
+
+#define POOL_MODE_LIST(X) \
+    X(POOL_COPY, "copy") \
+    X(POOL_COW, "cow")
+
+typedef enum {
+#define X(name, value) name,
+    POOL_MODE_LIST(X)
+#undef X
+} PoolMode;
+
+// NOTE: every instance lives in one arena slot, a reset brings a slot back to the pristine image either with one bulk
+//       copy (POOL_COPY, arena backed by huge pages when the system has them) or by mapping the image over the slot
+//       again (POOL_COW, pages stay shared with the image until the instance writes them)
+typedef struct {
+    PoolMode mode;
+    int      capacity;
+    size_t   slot_size;
+    size_t   arena_size;
+    uint8_t  *arena;
+    bool     huge;           // NOTE: arena came from MAP_HUGETLB, otherwise transparent huge pages are only advised
+    int      memfd;          // NOTE: holds the pristine image in POOL_COW, -1 otherwise
+    VM       *pristine;      // NOTE: copy of the image with an empty stack and no attachments
+    uint16_t *pristine_stack;
+    int      pristine_depth;
+    Stack    *stacks;        // NOTE: stack buffers survive a recycle, so a warm pool does no mallocs
+    int      *free_slots;
+    int      free_count;
+} VmPool;
+
+const char *vm_pool_mode_name(PoolMode mode);
+VmPool *vm_pool_init(VM *image, int capacity, PoolMode mode);
+void vm_pool_free(VmPool *pool);
+// NOTE: NULL when every slot is taken or the image stack could not be restored, an acquired VM lives in the arena
+//       and owns no stack buffer of its own, so it goes back through vm_pool_release and never through vm_free
+VM *vm_pool_acquire(VmPool *pool);
+void vm_pool_release(VmPool *pool, VM *vm);
+
+#endif
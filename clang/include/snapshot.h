@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "vm.h"
+
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#define SNAPSHOT_MAGIC   "SYNSNAP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_PAGE    4096 // NOTE: mem starts on its own page so the file can be mapped and copied without parsing
+
+#define SNAPSHOT_STATE_LIST(X) \
+    X(SNAPSHOT_OK, "snapshot is ok") \
+    X(SNAPSHOT_BINARY_READ_ERROR, "cannot read the source binary for hashing") \
+    X(SNAPSHOT_OPEN_ERROR, "cannot open the snapshot file") \
+    X(SNAPSHOT_WRITE_ERROR, "writing the snapshot file has failed") \
+    X(SNAPSHOT_MAP_ERROR, "mapping the snapshot file has failed") \
+    X(SNAPSHOT_BAD_HEADER_ERROR, "snapshot header is invalid or from another version") \
+    X(SNAPSHOT_HASH_MISMATCH_ERROR, "snapshot was taken from a different binary") \
+    X(SNAPSHOT_VM_ERROR, "vm failed while running to the first input") \
+    X(SNAPSHOT_NO_INPUT_ERROR, "vm halted before asking for input") \
+    X(SNAPSHOT_ALLOCATION_FAIL_ERROR, "memory allocation in snapshot has failed")
+
+typedef enum {
+#define X(name, value) name,
+    SNAPSHOT_STATE_LIST(X)
+#undef X
+} SnapshotStatus;
+
+// NOTE: header, mem, regs and stack are written in host byte order (only x86-64 is supported), sections follow the
+//       header at the given byte offsets
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t binary_hash;  // NOTE: FNV-1a 64 of the source binary file
+    uint32_t mem_offset;
+    uint32_t mem_words;
+    uint32_t regs_offset;
+    uint32_t reg_count;
+    uint32_t stack_offset;
+    uint32_t stack_words;
+    uint32_t out_offset;
+    uint32_t out_bytes;    // NOTE: output printed before the snapshot, replayed on resume
+    uint16_t pos;
+    uint8_t  halt;
+    uint8_t  reserved[5];
+} SnapshotHeader;
+
+const char *snapshot_get_error_msg(SnapshotStatus status);
+SnapshotStatus snapshot_hash_file(const char *path, uint64_t *hash);
+SnapshotStatus snapshot_save(VM *vm, const char *path, uint64_t binary_hash, const char *out, uint32_t out_bytes);
+SnapshotStatus snapshot_save_at_first_input(VM *vm, const char *path, const char *binary_path);
+SnapshotStatus snapshot_resume(VM *vm, const char *path, const char *binary_path);
+
+#endif
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 #ifndef _STACK_H_
 #define _STACK_H_
@@ -18,13 +19,16 @@ typedef enum {
 
 typedef struct {
     int          index;
+    int          peak;    // NOTE: highest index ever reached
     int          bufsize;
-    void        *buf;
     StackStatus status;
+    void        *buf;
 } Stack;
 
 Stack *stack_init();
 void stack_free(Stack *stack);
+bool stack_setup(Stack *stack);
+void stack_teardown(Stack *stack);
 const char *stack_get_error_msg(Stack *stack);
 void stack_push(Stack *stack, uint16_t val);
 uint16_t stack_pop(Stack *stack);
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdalign.h>
 #include "stack.h"
 
 #ifndef _VM_H_
@@ -13,6 +14,10 @@
 #define NO_REG  8           // NOTE: reg count is 8, then index cannot be 8
 #define NO_NUM  UINT16_MAX  // NOTE: all numbers below 32775, so this is ok
 
+#define NUM_END     (MODULO + REG_COUNT) // NOTE: first operand word that is neither a literal nor a register
+#define MEM_GUARD   3                    // NOTE: zeroed words after *mem*, operands of an instruction at the last word read them
+#define CACHE_LINE  64
+
 #define VM_STATE_LIST(X) \
     X(VM_OK, "vm is ok") \
     X(VM_STACK_INIT_FAIL_ERROR, "stack initialization fail in vm (check the stack error if stack exists)") \
@@ -30,14 +35,24 @@ typedef enum {
 #undef X
 } VM_Status;
 
+struct VmHooks;
+struct VmHeatmap;
+struct VmMetrics;
+struct VmDecoded;
+
 typedef struct {
+    // NOTE: *regs* starts a cache line and the hot fields below share it
+    alignas(CACHE_LINE) uint16_t regs[REG_COUNT];
+    uint16_t  pos;
     bool      halt;
     bool      should_skip_on_reg_or_num_err; // NOTE: if this is true when reg or num error occur then it skip that error and update the *pos* to read next instruction
     VM_Status status;
-    uint16_t  mem[MEM_SIZE];
-    uint16_t  regs[REG_COUNT];
-    Stack     *stack;
-    uint16_t  pos;
+    Stack     stack;
+    struct VmHooks *hooks;                   // NOTE: NULL unless native hooks are attached (see hooks.h)
+    struct VmHeatmap *heatmap;               // NOTE: NULL unless memory accesses are recorded (see heatmap.h)
+    struct VmMetrics *metrics;               // NOTE: NULL unless live counters are published (see metrics.h)
+    struct VmDecoded *decoded;               // NOTE: NULL unless instructions run from decoded records (see decode.h)
+    alignas(CACHE_LINE) uint16_t mem[MEM_SIZE + MEM_GUARD]; // NOTE: MEM_SIZE words are addressable, the rest is MEM_GUARD
 } VM;
 
 VM *vm_init(bool should_skip_on_reg_or_num_err);
@@ -49,6 +64,8 @@ void vm_print_memory(VM *vm);
 void vm_load_test(VM *vm);
 uint16_t vm_get_reg(uint16_t n);
 uint16_t vm_get_num(VM* vm, uint16_t n);
+uint16_t vm_inst_words(uint16_t op);
+uint64_t vm_hash_mem(VM *vm, uint16_t start, uint16_t end);
 void vm_next_inst(VM *vm);
 void vm_process(VM *vm);
 
@@ -1,7 +1,79 @@
 #include <stdio.h>
+#include <string.h>
 #include "../include/vm.h"
+#include "../include/snapshot.h"
+#include "../include/hooks.h"
+#include "../include/heatmap.h"
+#include "../include/metrics.h"
+#include "../include/decode.h"
+
+#define BINARY_PATH "../data/challenge.bin"
+
+void usage(const char *prog) {
+    printf("usage: %s [--save-at-first-input <snapshot> | --resume <snapshot>] [--hooks | --check-hooks] [--heatmap <prefix>] [--metrics <path>] [--decode-cache <path>] [--decode-stats]\n", prog);
+}
+
+// NOTE: writes <prefix>.map (binary, see heatmap_load) and <prefix>.txt (summary report)
+HeatmapStatus export_heatmap(const VmHeatmap *map, const char *prefix) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s.map", prefix);
+
+    HeatmapStatus status = heatmap_save(map, path);
+    if (status != HEATMAP_OK) {
+        printf("heatmap error: %s\n", heatmap_get_error_msg(status));
+        return status;
+    }
+
+    snprintf(path, sizeof(path), "%s.txt", prefix);
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        printf("heatmap error: %s\n", heatmap_get_error_msg(HEATMAP_OPEN_ERROR));
+        return HEATMAP_OPEN_ERROR;
+    }
+    heatmap_report(map, fp);
+    fclose(fp);
+    return HEATMAP_OK;
+}
+
+int main(int argc, char **argv) {
+    const char *save_path   = NULL;
+    const char *resume_path = NULL;
+    bool        hooks       = false;
+    bool        check_hooks = false;
+    const char *heatmap     = NULL;
+    const char *metrics     = NULL;
+    const char *decode      = NULL;
+    bool        decode_stat = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--save-at-first-input") == 0 && i + 1 < argc) {
+            save_path = argv[++i];
+        } else if (strcmp(argv[i], "--resume") == 0 && i + 1 < argc) {
+            resume_path = argv[++i];
+        } else if (strcmp(argv[i], "--heatmap") == 0 && i + 1 < argc) {
+            heatmap = argv[++i];
+        } else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+            metrics = argv[++i];
+        } else if (strcmp(argv[i], "--decode-cache") == 0 && i + 1 < argc) {
+            decode = argv[++i];
+        } else if (strcmp(argv[i], "--decode-stats") == 0) {
+            decode_stat = true;
+        } else if (strcmp(argv[i], "--hooks") == 0) {
+            hooks = true;
+        } else if (strcmp(argv[i], "--check-hooks") == 0) {
+            hooks       = true;
+            check_hooks = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (save_path != NULL && resume_path != NULL) {
+        usage(argv[0]);
+        return 1;
+    }
 
-int main() {
     VM* vm = vm_init(false);
     if (vm == NULL) {
         printf("virtual machine initialization is fail\n");
@@ -14,13 +86,67 @@ int main() {
         return 1;
     }
 
-    vm_load_binary(vm, "../data/challenge.bin");
-    if (vm->status != VM_OK) {
-        printf("vm error: %s\n", vm_get_error_msg(vm));
+    if (resume_path != NULL) {
+        SnapshotStatus status = snapshot_resume(vm, resume_path, BINARY_PATH);
+        if (status != SNAPSHOT_OK) {
+            printf("snapshot error: %s\n", snapshot_get_error_msg(status));
+            vm_free(vm);
+            return 1;
+        }
+    } else {
+        vm_load_binary(vm, BINARY_PATH);
+        if (vm->status != VM_OK) {
+            printf("vm error: %s\n", vm_get_error_msg(vm));
+            vm_free(vm);
+            return 1;
+        }
+    }
+
+    if (save_path != NULL) {
+        SnapshotStatus status = snapshot_save_at_first_input(vm, save_path, BINARY_PATH);
+        if (status != SNAPSHOT_OK) {
+            printf("snapshot error: %s\n", snapshot_get_error_msg(status));
+            vm_free(vm);
+            return 1;
+        }
+    }
+
+    // NOTE: attached after the snapshot step, its transcript only sees output of interpreted *out* instructions
+    if (hooks && !vm_hooks_attach(vm, check_hooks)) {
+        printf("native hooks could not be attached\n");
+        vm_free(vm);
+        return 1;
+    }
+
+    if (heatmap != NULL && !vm_heatmap_attach(vm)) {
+        printf("heatmap could not be attached\n");
         vm_free(vm);
         return 1;
     }
 
+    if (metrics != NULL && !vm_metrics_attach(vm, metrics)) {
+        printf("metrics region could not be created\n");
+        vm_free(vm);
+        return 1;
+    }
+
+    // NOTE: the cache only speeds things up, a missing or rejected one means a cold start and gets rewritten at exit
+    uint64_t binary_hash = 0;
+    if (decode != NULL) {
+        if (!vm_decoded_attach(vm)) {
+            printf("decoded records could not be attached\n");
+            vm_free(vm);
+            return 1;
+        }
+
+        DecodeStatus status = snapshot_hash_file(BINARY_PATH, &binary_hash) == SNAPSHOT_OK
+            ? decode_cache_load(vm, decode, binary_hash)
+            : DECODE_BINARY_MISMATCH_ERROR;
+        if (status != DECODE_OK && status != DECODE_OPEN_ERROR) {
+            fprintf(stderr, "decode cache ignored: %s\n", decode_get_error_msg(status));
+        }
+    }
+
     /*
     // vm_print_memory(vm);
     vm_load_test(vm);
@@ -32,9 +158,28 @@ int main() {
     */
 
     vm_process(vm);
+    if (check_hooks) {
+        vm_hooks_print_stats(vm, stderr);
+    }
+
+    if (decode != NULL) {
+        DecodeStatus status = decode_cache_save(vm, decode, binary_hash);
+        if (status != DECODE_OK) {
+            fprintf(stderr, "decode cache error: %s\n", decode_get_error_msg(status));
+        }
+        if (decode_stat) {
+            vm_decoded_print_stats(vm, stderr);
+        }
+    }
+
+    if (heatmap != NULL && export_heatmap(vm->heatmap, heatmap) != HEATMAP_OK) {
+        vm_free(vm);
+        return 1;
+    }
+
     if (vm->status != VM_OK) {
         printf("vm error   : %s\n", vm_get_error_msg(vm));
-        printf("stack error: %s\n", stack_get_error_msg(vm->stack));
+        printf("stack error: %s\n", stack_get_error_msg(&vm->stack));
         vm_free(vm);
         return 1;
     }
@@ -0,0 +1,739 @@
+#include <string.h>
+#include "../../include/batch.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+static const char *batch_isa_names[] = {
+#define X(name, value) [name] = value,
+    BATCH_ISA_LIST(X)
+#undef X
+};
+
+typedef void (*BatchKernel)(uint16_t op, uint16_t *dst, const uint16_t *b, const uint16_t *c, const uint16_t *mask, int lanes);
+
+const char *vm_batch_isa_name(BatchIsa isa) {
+    switch (isa) {
+#define X(name, value) case name: return batch_isa_names[name];
+        BATCH_ISA_LIST(X)
+#undef X
+        default:
+            return "undefined batch isa value";
+    }
+}
+
+BatchIsa vm_batch_detect_isa() {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return BATCH_ISA_AVX2;
+    }
+    return BATCH_ISA_SSE2; // NOTE: part of the x86-64 baseline
+#else
+    return BATCH_ISA_SCALAR;
+#endif
+}
+
+static uint16_t batch_alu_one(uint16_t op, uint16_t b, uint16_t c) {
+    switch (op) {
+        case 1:  return b;
+        case 4:  return b == c;
+        case 5:  return b > c;
+        case 9:  return (b + c) % MODULO;
+        case 10: return (uint16_t)(((uint32_t)b * c) % MODULO);
+        case 11: return b % c;
+        case 12: return (b & c) % MODULO;
+        case 13: return (b | c) % MODULO;
+        case 14: return ((uint16_t)~b) % MODULO;
+        default: return 0;
+    }
+}
+
+static void batch_kernel_scalar(uint16_t op, uint16_t *dst, const uint16_t *b, const uint16_t *c, const uint16_t *mask, int lanes) {
+    for (int i = 0; i < lanes; i++) {
+        if (mask[i]) {
+            dst[i] = batch_alu_one(op, b[i], c[i]);
+        }
+    }
+}
+
+#if defined(__x86_64__)
+
+// NOTE: all results are computed on 16 bit lanes and masked to 15 bits, which matches % MODULO because 65536 is a
+//       multiple of 32768; gt flips the sign bit to get an unsigned compare, mod goes through float which is exact
+//       for 16 bit operands, the caller never hands in an active lane with a zero divisor
+#define BATCH_KERNEL_BODY(W, V, SI)                                                                   \
+    const V m15  = _mm##W##_set1_epi16(0x7fff);                                                      \
+    const V one  = _mm##W##_set1_epi16(1);                                                           \
+    const V sign = _mm##W##_set1_epi16((short)0x8000);                                               \
+    const V zero = _mm##W##_setzero_##SI();                                                          \
+    const V bias = _mm##W##_set1_epi32(0x8000);                                                      \
+    for (int i = 0; i < lanes; i += (int)(sizeof(V) / sizeof(uint16_t))) {                           \
+        V vb = _mm##W##_load_##SI((const V *)(b + i));                                               \
+        V vc = _mm##W##_load_##SI((const V *)(c + i));                                               \
+        V vm = _mm##W##_load_##SI((const V *)(mask + i));                                            \
+        V vd = _mm##W##_load_##SI((const V *)(dst + i));                                             \
+        V r;                                                                                          \
+        switch (op) {                                                                                 \
+            case 1:  r = vb; break;                                                                   \
+            case 4:  r = _mm##W##_and_##SI(_mm##W##_cmpeq_epi16(vb, vc), one); break;                \
+            case 5:  r = _mm##W##_and_##SI(_mm##W##_cmpgt_epi16(_mm##W##_xor_##SI(vb, sign),         \
+                                                                  _mm##W##_xor_##SI(vc, sign)), one); break; \
+            case 9:  r = _mm##W##_and_##SI(_mm##W##_add_epi16(vb, vc), m15); break;                  \
+            case 10: r = _mm##W##_and_##SI(_mm##W##_mullo_epi16(vb, vc), m15); break;                \
+            case 12: r = _mm##W##_and_##SI(_mm##W##_and_##SI(vb, vc), m15); break;                   \
+            case 13: r = _mm##W##_and_##SI(_mm##W##_or_##SI(vb, vc), m15); break;                    \
+            case 14: r = _mm##W##_andnot_##SI(vb, m15); break;                                       \
+            case 11: {                                                                                \
+                V parts[2];                                                                           \
+                for (int h = 0; h < 2; h++) {                                                         \
+                    V b32 = h ? _mm##W##_unpackhi_epi16(vb, zero) : _mm##W##_unpacklo_epi16(vb, zero); \
+                    V c32 = h ? _mm##W##_unpackhi_epi16(vc, zero) : _mm##W##_unpacklo_epi16(vc, zero); \
+                    __typeof__(_mm##W##_cvtepi32_ps(b32)) fb = _mm##W##_cvtepi32_ps(b32);             \
+                    __typeof__(fb) fc = _mm##W##_cvtepi32_ps(c32);                                    \
+                    __typeof__(fb) fq = _mm##W##_cvtepi32_ps(_mm##W##_cvttps_epi32(_mm##W##_div_ps(fb, fc))); \
+                    V rem = _mm##W##_cvttps_epi32(_mm##W##_sub_ps(fb, _mm##W##_mul_ps(fq, fc)));      \
+                    parts[h] = _mm##W##_sub_epi32(rem, bias);                                         \
+                }                                                                                     \
+                r = _mm##W##_xor_##SI(_mm##W##_packs_epi32(parts[0], parts[1]), sign);               \
+                break;                                                                                \
+            }                                                                                         \
+            default: r = vd; break;                                                                   \
+        }                                                                                             \
+        r = _mm##W##_or_##SI(_mm##W##_and_##SI(vm, r), _mm##W##_andnot_##SI(vm, vd));                \
+        _mm##W##_store_##SI((V *)(dst + i), r);                                                      \
+    }
+
+static void batch_kernel_sse2(uint16_t op, uint16_t *dst, const uint16_t *b, const uint16_t *c, const uint16_t *mask, int lanes) {
+    BATCH_KERNEL_BODY(, __m128i, si128)
+}
+
+__attribute__((target("avx2")))
+static void batch_kernel_avx2(uint16_t op, uint16_t *dst, const uint16_t *b, const uint16_t *c, const uint16_t *mask, int lanes) {
+    BATCH_KERNEL_BODY(256, __m256i, si256)
+}
+
+#endif
+
+static BatchKernel batch_kernel(BatchIsa isa) {
+    switch (isa) {
+#if defined(__x86_64__)
+        case BATCH_ISA_SSE2: return batch_kernel_sse2;
+        case BATCH_ISA_AVX2: return batch_kernel_avx2;
+#endif
+        default:             return batch_kernel_scalar;
+    }
+}
+
+static uint16_t *batch_alloc_lanes(int lanes) {
+    uint16_t *buf = aligned_alloc(32, sizeof(uint16_t) * lanes);
+    if (buf != NULL) {
+        memset(buf, 0, sizeof(uint16_t) * lanes);
+    }
+    return buf;
+}
+
+VmBatch *vm_batch_init(int count, BatchIsa isa) {
+    if (count <= 0) {
+        return NULL;
+    }
+
+    VmBatch *batch = (VmBatch *)calloc(1, sizeof(VmBatch));
+    if (batch == NULL) {
+        return NULL;
+    }
+
+    if (isa == BATCH_ISA_AUTO) {
+        isa = vm_batch_detect_isa();
+    } else if (isa != BATCH_ISA_SCALAR && isa != vm_batch_detect_isa() && !(isa == BATCH_ISA_SSE2 && vm_batch_detect_isa() == BATCH_ISA_AVX2)) {
+        free(batch);
+        return NULL;
+    }
+
+    batch->count = count;
+    batch->lanes = (count + BATCH_LANE_ALIGN - 1) / BATCH_LANE_ALIGN * BATCH_LANE_ALIGN;
+    batch->isa   = isa;
+
+    bool ok = (batch->vms = (VM **)calloc(count, sizeof(VM *))) != NULL;
+    for (int r = 0; ok && r < REG_COUNT; r++) {
+        ok = (batch->regs[r] = batch_alloc_lanes(batch->lanes)) != NULL;
+    }
+    ok = ok && (batch->pos = batch_alloc_lanes(batch->lanes)) != NULL;
+    ok = ok && (batch->mask = batch_alloc_lanes(batch->lanes)) != NULL;
+    ok = ok && (batch->lit[0] = batch_alloc_lanes(batch->lanes)) != NULL;
+    ok = ok && (batch->lit[1] = batch_alloc_lanes(batch->lanes)) != NULL;
+    ok = ok && (batch->dirty = (uint8_t *)calloc(MEM_SIZE / 8, 1)) != NULL;
+    ok = ok && (batch->wait = (uint8_t *)calloc(MEM_SIZE / 8, 1)) != NULL;
+    for (int i = 0; ok && i < count; i++) {
+        ok = (batch->vms[i] = vm_init(false)) != NULL;
+    }
+
+    if (!ok) {
+        vm_batch_free(batch);
+        return NULL;
+    }
+
+    return batch;
+}
+
+void vm_batch_free(VmBatch *batch) {
+    if (batch == NULL) {
+        return;
+    }
+
+    if (batch->vms != NULL) {
+        for (int i = 0; i < batch->count; i++) {
+            vm_free(batch->vms[i]);
+        }
+        free(batch->vms);
+    }
+
+    for (int r = 0; r < REG_COUNT; r++) {
+        free(batch->regs[r]);
+    }
+    free(batch->pos);
+    free(batch->mask);
+    free(batch->lit[0]);
+    free(batch->lit[1]);
+    free(batch->dirty);
+    free(batch->wait);
+    free(batch);
+}
+
+bool vm_batch_load(VmBatch *batch, VM *image) {
+    if (image->status != VM_OK) {
+        return false;
+    }
+
+    memset(batch->dirty, 0, MEM_SIZE / 8);
+    for (int i = 0; i < batch->count; i++) {
+        VM *vm = batch->vms[i];
+        memcpy(vm->mem, image->mem, sizeof(vm->mem));
+        vm->halt   = image->halt;
+        vm->status = VM_OK;
+
+        vm->stack.index  = -1;
+        vm->stack.status = STACK_OK;
+        for (int s = 0; s <= image->stack.index; s++) {
+            stack_push(&vm->stack, ((uint16_t *)image->stack.buf)[s]);
+        }
+        if (vm->stack.status != STACK_OK) {
+            return false;
+        }
+
+        for (int r = 0; r < REG_COUNT; r++) {
+            batch->regs[r][i] = image->regs[r];
+        }
+        batch->pos[i] = image->pos;
+    }
+
+    return true;
+}
+
+bool vm_batch_active(VmBatch *batch, int lane) {
+    VM *vm = batch->vms[lane];
+    return vm->status == VM_OK && !vm->halt && batch->pos[lane] < MEM_SIZE;
+}
+
+void vm_batch_sync(VmBatch *batch) {
+    for (int i = 0; i < batch->count; i++) {
+        for (int r = 0; r < REG_COUNT; r++) {
+            batch->vms[i]->regs[r] = batch->regs[r][i];
+        }
+        batch->vms[i]->pos = batch->pos[i];
+    }
+}
+
+static void batch_mark_dirty(VmBatch *batch, uint16_t addr) {
+    if (addr < MEM_SIZE) {
+        batch->dirty[addr / 8] |= (uint8_t)(1 << (addr % 8));
+    }
+}
+
+static bool batch_is_dirty(VmBatch *batch, uint16_t p, int width) {
+    for (int i = p; i < p + width && i < MEM_SIZE; i++) {
+        if (batch->dirty[i / 8] & (1 << (i % 8))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// NOTE: one instruction of one lane on its own VM, the caller keeps regs and pos of the VM in sync with the lane
+static void batch_exec_lane(VmBatch *batch, int lane, VM *vm) {
+    uint16_t reg, a;
+    switch (vm->mem[vm->pos]) {
+        case 16: // wmem
+            // NOTE: the other lanes did not make this write, so their code may differ from here on
+            batch_mark_dirty(batch, vm_get_num(vm, vm->mem[vm->pos + 1]));
+            vm_next_inst(vm);
+            break;
+        case 19: // out
+            a = vm_get_num(vm, vm->mem[vm->pos + 1]);
+            if (a == NO_NUM) {
+                vm_next_inst(vm);
+                break;
+            }
+            if (batch->on_out != NULL) {
+                batch->on_out(lane, a, batch->ctx);
+            }
+            vm->pos += 2;
+            break;
+        case 20: // in
+            reg = vm_get_reg(vm->mem[vm->pos + 1]);
+            if (reg == NO_REG) {
+                vm_next_inst(vm);
+                break;
+            }
+            int ch = batch->on_in != NULL ? batch->on_in(lane, batch->ctx) : -1;
+            if (ch < 0) {
+                vm->halt = true;
+                break;
+            }
+            vm->regs[reg] = (uint16_t)ch;
+            vm->pos += 2;
+            break;
+        default:
+            vm_next_inst(vm);
+            break;
+    }
+    batch->scalar_steps++;
+}
+
+static void batch_lane_to_vm(VmBatch *batch, int lane) {
+    VM *vm = batch->vms[lane];
+    for (int r = 0; r < REG_COUNT; r++) {
+        vm->regs[r] = batch->regs[r][lane];
+    }
+    vm->pos = batch->pos[lane];
+}
+
+static void batch_vm_to_lane(VmBatch *batch, int lane) {
+    VM *vm = batch->vms[lane];
+    for (int r = 0; r < REG_COUNT; r++) {
+        batch->regs[r][lane] = vm->regs[r];
+    }
+    batch->pos[lane] = vm->pos;
+}
+
+static void batch_step_scalar(VmBatch *batch, int lane) {
+    batch_lane_to_vm(batch, lane);
+    batch_exec_lane(batch, lane, batch->vms[lane]);
+    batch_vm_to_lane(batch, lane);
+}
+
+// NOTE: a group of one runs straight on its VM with registers synced once, until it reaches a pos another lane
+//       waits at (where they may group again), stops, or the step budget runs out
+static uint64_t batch_run_solo(VmBatch *batch, int lane, uint64_t max_steps) {
+    for (int i = 0; i < batch->count; i++) {
+        if (i != lane && vm_batch_active(batch, i)) {
+            batch->wait[batch->pos[i] / 8] |= (uint8_t)(1 << (batch->pos[i] % 8));
+        }
+    }
+
+    VM *vm = batch->vms[lane];
+    uint64_t steps = 0;
+    batch_lane_to_vm(batch, lane);
+    do {
+        batch_exec_lane(batch, lane, vm);
+        steps++;
+    } while (steps < max_steps && vm->status == VM_OK && !vm->halt && vm->pos < MEM_SIZE
+             && !(batch->wait[vm->pos / 8] & (1 << (vm->pos % 8))));
+    batch_vm_to_lane(batch, lane);
+
+    for (int i = 0; i < batch->count; i++) {
+        if (i != lane && vm_batch_active(batch, i)) {
+            batch->wait[batch->pos[i] / 8] = 0;
+        }
+    }
+    return steps;
+}
+
+// NOTE: row of per lane values for an operand, literals are broadcast into *lit*, NULL for invalid numbers
+static const uint16_t *batch_operand(VmBatch *batch, uint16_t n, int slot) {
+    if (n < MODULO) {
+        if (batch->lit_val[slot] != n) {
+            for (int i = 0; i < batch->lanes; i++) {
+                batch->lit[slot][i] = n;
+            }
+            batch->lit_val[slot] = n;
+        }
+        return batch->lit[slot];
+    }
+    uint16_t reg = vm_get_reg(n);
+    return reg == NO_REG ? NULL : batch->regs[reg];
+}
+
+typedef enum {
+    BATCH_STEP_FALLBACK, // NOTE: nothing ran, the group has to go through the scalar path
+    BATCH_STEP_UNIFORM,  // NOTE: every lane of the group continues at *next*, pos of the lanes is not touched
+    BATCH_STEP_SPLIT,    // NOTE: lanes branched differently, pos of every lane in the group is written
+} BatchStep;
+
+// NOTE: lanes of the group as a jump target, uniform when all of them agree
+static BatchStep batch_jump(VmBatch *batch, const uint16_t *target, const uint16_t *cond, bool when, uint16_t fallthrough, uint16_t *next) {
+    int first = -1;
+    bool uniform = true;
+    for (int i = 0; i < batch->count && uniform; i++) {
+        if (!batch->mask[i]) {
+            continue;
+        }
+        uint16_t to = (cond == NULL || (cond[i] != 0) == when) ? target[i] : fallthrough;
+        if (first == -1) {
+            first = i;
+            *next = to;
+        } else if (to != *next) {
+            uniform = false;
+        }
+    }
+    if (uniform) {
+        return BATCH_STEP_UNIFORM;
+    }
+
+    for (int i = 0; i < batch->count; i++) {
+        if (batch->mask[i]) {
+            batch->pos[i] = (cond == NULL || (cond[i] != 0) == when) ? target[i] : fallthrough;
+        }
+    }
+    return BATCH_STEP_SPLIT;
+}
+
+// NOTE: pos of every lane in the group was written, uniform when they all agree
+static BatchStep batch_lanes_done(VmBatch *batch, uint16_t *next) {
+    int first = -1;
+    for (int i = 0; i < batch->count; i++) {
+        if (!batch->mask[i] || !vm_batch_active(batch, i)) {
+            if (batch->mask[i]) {
+                return BATCH_STEP_SPLIT;
+            }
+            continue;
+        }
+        if (first == -1) {
+            first = i;
+            *next = batch->pos[i];
+        } else if (batch->pos[i] != *next) {
+            return BATCH_STEP_SPLIT;
+        }
+    }
+    return BATCH_STEP_UNIFORM;
+}
+
+// NOTE: stack, memory and output ops, looped over the group on the struct-of-arrays registers so no lane has to be
+//       synced into its VM, lanes that would hit an error path still go through vm_next_inst, *converged* is set
+//       when the group holds every active lane
+static BatchStep batch_step_lanes(VmBatch *batch, uint16_t p, const uint16_t *code, bool converged, uint16_t *next) {
+    uint16_t op = code[0];
+    const uint16_t *a = NULL, *b = NULL;
+    uint16_t reg = NO_REG;
+
+    switch (op) {
+        case 2:  // push
+        case 17: // call
+        case 19: // out
+            a = batch_operand(batch, code[1], 0);
+            if (a == NULL) {
+                return BATCH_STEP_FALLBACK;
+            }
+            break;
+        case 3: // pop
+            reg = vm_get_reg(code[1]);
+            if (reg == NO_REG) {
+                return BATCH_STEP_FALLBACK;
+            }
+            break;
+        case 15: // rmem
+            reg = vm_get_reg(code[1]);
+            b   = batch_operand(batch, code[2], 1);
+            if (reg == NO_REG || b == NULL) {
+                return BATCH_STEP_FALLBACK;
+            }
+            break;
+        case 16: // wmem
+            a = batch_operand(batch, code[1], 0);
+            b = batch_operand(batch, code[2], 1);
+            if (a == NULL || b == NULL) {
+                return BATCH_STEP_FALLBACK;
+            }
+            break;
+        case 18: // ret
+            break;
+        default:
+            return BATCH_STEP_FALLBACK;
+    }
+
+    bool same_write = true;
+    int  first      = -1;
+    for (int i = 0; i < batch->count; i++) {
+        if (!batch->mask[i]) {
+            continue;
+        }
+
+        VM *vm = batch->vms[i];
+        batch->pos[i] = p;
+
+        bool empty = vm->stack.index < 0;
+        bool fallback = vm->stack.status != STACK_OK
+            || ((op == 3 || op == 18) && empty)
+            || (op == 15 && b[i] >= MEM_SIZE)
+            || (op == 16 && a[i] >= MEM_SIZE);
+        if (fallback) {
+            batch_step_scalar(batch, i);
+            same_write = false;
+            continue;
+        }
+
+        switch (op) {
+            case 2: // push
+                stack_push(&vm->stack, a[i]);
+                batch->pos[i] = vm->stack.status == STACK_OK ? p + 2 : p;
+                break;
+            case 3: // pop
+                batch->regs[reg][i] = stack_pop(&vm->stack);
+                batch->pos[i] = p + 2;
+                break;
+            case 15: // rmem
+                batch->regs[reg][i] = vm->mem[b[i]];
+                batch->pos[i] = p + 3;
+                break;
+            case 16: // wmem
+                vm->mem[a[i]] = b[i];
+                batch->pos[i] = p + 3;
+                if (first != -1 && (a[i] != a[first] || b[i] != b[first])) {
+                    same_write = false;
+                }
+                break;
+            case 17: // call
+                stack_push(&vm->stack, p + 2);
+                batch->pos[i] = vm->stack.status == STACK_OK ? a[i] : p;
+                break;
+            case 18: // ret
+                batch->pos[i] = stack_pop(&vm->stack);
+                break;
+            case 19: // out
+                if (batch->on_out != NULL) {
+                    batch->on_out(i, a[i], batch->ctx);
+                }
+                batch->pos[i] = p + 2;
+                break;
+        }
+        if (first == -1) {
+            first = i;
+        }
+    }
+
+    // NOTE: lanes outside the group did not make this write, and lanes that wrote different words may no longer
+    //       share code, remember the words so a group that converges again checks them before running code there
+    if (op == 16 && (!converged || !same_write)) {
+        for (int i = 0; i < batch->count; i++) {
+            if (batch->mask[i]) {
+                batch_mark_dirty(batch, a[i]);
+            }
+        }
+    }
+    if (op == 16 && !same_write) {
+        return BATCH_STEP_SPLIT;
+    }
+    return batch_lanes_done(batch, next);
+}
+
+static BatchStep batch_step_vector(VmBatch *batch, uint16_t p, const uint16_t *code, BatchKernel kernel, bool converged, uint16_t *next) {
+    uint16_t op = code[0];
+    const uint16_t *a, *b, *c;
+    uint16_t reg;
+
+    switch (op) {
+        case 1:  // set
+        case 14: // not
+            reg = vm_get_reg(code[1]);
+            b   = batch_operand(batch, code[2], 0);
+            if (reg == NO_REG || b == NULL) {
+                return BATCH_STEP_FALLBACK;
+            }
+            kernel(op, batch->regs[reg], b, b, batch->mask, batch->lanes);
+            break;
+        case 4:  // eq
+        case 5:  // gt
+        case 9:  // add
+        case 10: // mult
+        case 11: // mod
+        case 12: // and
+        case 13: // or
+            reg = vm_get_reg(code[1]);
+            b   = batch_operand(batch, code[2], 0);
+            c   = batch_operand(batch, code[3], 1);
+            if (reg == NO_REG || b == NULL || c == NULL) {
+                return BATCH_STEP_FALLBACK;
+            }
+            if (op == 11) {
+                for (int i = 0; i < batch->count; i++) {
+                    if (batch->mask[i] && c[i] == 0) {
+                        return BATCH_STEP_FALLBACK;
+                    }
+                }
+            }
+            kernel(op, batch->regs[reg], b, c, batch->mask, batch->lanes);
+            break;
+        case 6: // jmp
+            a = batch_operand(batch, code[1], 0);
+            if (a == NULL) {
+                return BATCH_STEP_FALLBACK;
+            }
+            return batch_jump(batch, a, NULL, true, 0, next);
+        case 7: // jt
+        case 8: // jf
+            a = batch_operand(batch, code[1], 0);
+            b = batch_operand(batch, code[2], 1);
+            if (a == NULL || b == NULL) {
+                return BATCH_STEP_FALLBACK;
+            }
+            return batch_jump(batch, b, a, op == 7, p + 3, next);
+        case 21: // noop
+            break;
+        default:
+            return batch_step_lanes(batch, p, code, converged, next);
+    }
+
+    *next = p + vm_inst_words(op);
+    return BATCH_STEP_UNIFORM;
+}
+
+// NOTE: builds the mask for the group at the lowest *pos* and returns its leader lane, -1 once every lane stopped
+static int batch_group(VmBatch *batch, int *group) {
+    // NOTE: lanes that branched ahead wait for the others to catch up
+    int leader = -1;
+    for (int i = 0; i < batch->count; i++) {
+        if (vm_batch_active(batch, i) && (leader == -1 || batch->pos[i] < batch->pos[leader])) {
+            leader = i;
+        }
+    }
+    if (leader == -1) {
+        return -1;
+    }
+
+    uint16_t  p     = batch->pos[leader];
+    uint16_t *code  = &batch->vms[leader]->mem[p];
+    int       width = vm_inst_words(code[0]);
+    if (p + width > MEM_SIZE) {
+        width = MEM_SIZE - p;
+    }
+
+    // NOTE: lanes only join the group if their code words match too, a lane may have rewritten its own code
+    *group = 0;
+    for (int i = 0; i < batch->lanes; i++) {
+        bool join = i < batch->count && batch->pos[i] == p && vm_batch_active(batch, i)
+            && memcmp(&batch->vms[i]->mem[p], code, sizeof(uint16_t) * width) == 0;
+        batch->mask[i] = join ? 0xffff : 0;
+        *group += join;
+    }
+    return leader;
+}
+
+uint64_t vm_batch_run(VmBatch *batch, uint64_t max_steps) {
+    BatchKernel kernel = batch_kernel(batch->isa);
+    uint64_t steps = 0;
+
+    // NOTE: while *converged* the mask holds every active lane, they all sit at *p* and their pos entries are stale
+    bool     converged = false;
+    int      leader    = -1;
+    int      group     = 0;
+    uint16_t p         = 0;
+
+    batch->lit_val[0] = -1;
+    batch->lit_val[1] = -1;
+
+    while (steps < max_steps) {
+        bool regrouped = !converged;
+        if (!converged) {
+            leader = batch_group(batch, &group);
+            if (leader == -1) {
+                break;
+            }
+            p = batch->pos[leader];
+
+            if (group == 1) {
+                steps += batch_run_solo(batch, leader, max_steps - steps);
+                continue;
+            }
+
+            int active = 0;
+            for (int i = 0; i < batch->count; i++) {
+                active += vm_batch_active(batch, i);
+            }
+            converged = group == active;
+        }
+
+        uint16_t words[4] = {0};
+        uint16_t op       = batch->vms[leader]->mem[p];
+        int      width    = vm_inst_words(op);
+
+        // NOTE: converged steps run the leader's code for everyone, which is only safe where no lane wrote alone
+        if (!regrouped && batch_is_dirty(batch, p, width)) {
+            for (int i = 0; i < batch->count; i++) {
+                if (batch->mask[i]) {
+                    batch->pos[i] = p;
+                }
+            }
+            converged = false;
+            continue;
+        }
+
+        memcpy(words, &batch->vms[leader]->mem[p], sizeof(uint16_t) * (p + width > MEM_SIZE ? MEM_SIZE - p : width));
+
+        uint16_t  next   = 0;
+        BatchStep result = group > 1 ? batch_step_vector(batch, p, words, kernel, converged, &next) : BATCH_STEP_FALLBACK;
+        steps++;
+
+        if (result == BATCH_STEP_UNIFORM) {
+            batch->vector_steps++;
+            if (converged) {
+                p = next;
+            } else {
+                for (int i = 0; i < batch->count; i++) {
+                    if (batch->mask[i]) {
+                        batch->pos[i] = next;
+                    }
+                }
+            }
+            continue;
+        }
+
+        if (result == BATCH_STEP_SPLIT) {
+            batch->vector_steps++;
+            converged = false;
+            continue;
+        }
+
+        bool stay = converged && op != 16; // NOTE: a wmem may write different code into different lanes
+        bool first = true;
+        uint16_t after = 0;
+        for (int i = 0; i < batch->count; i++) {
+            if (!batch->mask[i]) {
+                continue;
+            }
+            if (converged) {
+                batch->pos[i] = p;
+            }
+            batch_step_scalar(batch, i);
+            if (!vm_batch_active(batch, i) || (!first && batch->pos[i] != after)) {
+                stay = false;
+            }
+            after = batch->pos[i];
+            first = false;
+        }
+
+        converged = stay;
+        p = after;
+    }
+
+    // NOTE: hand back a consistent pos array
+    if (converged) {
+        for (int i = 0; i < batch->count; i++) {
+            if (batch->mask[i]) {
+                batch->pos[i] = p;
+            }
+        }
+    }
+
+    return steps;
+}
@@ -0,0 +1,623 @@
+#define _DEFAULT_SOURCE
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../../include/decode.h"
+#include "../../include/hooks.h"
+
+#define DECODE_OP_COUNT 22
+
+static const char *decode_error_msgs[] = {
+#define X(name, value) [name] = value,
+    DECODE_STATE_LIST(X)
+#undef X
+};
+
+// NOTE: which operands of every opcode are registers (bit i for operand i), the operand count is vm_inst_words - 1
+static const uint8_t decode_reg_args[DECODE_OP_COUNT] = {
+    [1] = 1, [3] = 1, [4] = 1, [5] = 1, [9] = 1, [10] = 1, [11] = 1, [12] = 1, [13] = 1, [14] = 1, [15] = 1,
+};
+
+const char *decode_get_error_msg(DecodeStatus status) {
+    switch (status) {
+#define X(name, value) case name: return decode_error_msgs[name];
+        DECODE_STATE_LIST(X)
+#undef X
+        default:
+            return "undefined decode status value";
+    }
+}
+
+bool vm_decoded_attach(VM *vm) {
+    if (vm->status != VM_OK) {
+        return false;
+    }
+
+    VmDecoded *dec = (VmDecoded *)calloc(1, sizeof(VmDecoded));
+    if (dec == NULL) {
+        return false;
+    }
+
+    for (int i = 0; i < MEM_SIZE; i++) {
+        dec->insts[i].op = DECODE_NONE;
+        dec->block_at[i] = DECODE_NO_BLOCK;
+        dec->pending[i]  = DECODE_NO_BLOCK;
+    }
+
+    vm_decoded_detach(vm);
+    vm->decoded = dec;
+    return true;
+}
+
+void vm_decoded_detach(VM *vm) {
+    if (vm->decoded == NULL) {
+        return;
+    }
+
+    if (vm->decoded->cache != NULL) {
+        munmap((void *)vm->decoded->cache, vm->decoded->cache_size);
+    }
+    free(vm->decoded->blocks);
+    free(vm->decoded);
+    vm->decoded = NULL;
+}
+
+static bool decode_ends_block(uint16_t op) {
+    switch (op) {
+        case 0:  // halt
+        case 6:  // jmp
+        case 7:  // jt
+        case 8:  // jf
+        case 17: // call
+        case 18: // ret
+            return true;
+        default:
+            return op >= DECODE_OP_COUNT;
+    }
+}
+
+// NOTE: I/O, halt and any operand vm_next_inst would reject stay on the slow path
+static DecodedInst decode_inst(VM *vm, uint16_t pos) {
+    DecodedInst inst = {.op = DECODE_SLOW};
+    uint16_t op = vm->mem[pos];
+
+    switch (op) {
+        case 1: case 2: case 3: case 4: case 5: case 6: case 7: case 8: case 9: case 10:
+        case 11: case 12: case 13: case 14: case 15: case 16: case 17: case 18: case 21:
+            break;
+        default:
+            return inst;
+    }
+
+    for (int i = 0; i < vm_inst_words(op) - 1; i++) {
+        uint16_t word = vm->mem[pos + 1 + i];
+        if (decode_reg_args[op] & (1 << i)) {
+            uint16_t reg = vm_get_reg(word);
+            if (reg == NO_REG) {
+                return inst;
+            }
+            inst.args[i] = reg;
+        } else {
+            if (word >= NUM_END) {
+                return inst;
+            }
+            inst.args[i] = word;
+        }
+    }
+
+    inst.op = op;
+    return inst;
+}
+
+static bool decode_inst_ok(const DecodedInst *inst, uint16_t op) {
+    if (inst->op == DECODE_SLOW) {
+        return true;
+    }
+    if (inst->op != op || op >= DECODE_OP_COUNT) {
+        return false;
+    }
+
+    for (int i = 0; i < vm_inst_words(op) - 1; i++) {
+        uint16_t limit = (decode_reg_args[op] & (1 << i)) ? REG_COUNT : NUM_END;
+        if (inst->args[i] >= limit) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int32_t decode_add_block(VmDecoded *dec, uint16_t start, uint16_t words, uint64_t hash) {
+    if (dec->block_count == dec->block_cap) {
+        uint32_t cap = dec->block_cap == 0 ? 256 : dec->block_cap * 2;
+        DecodedBlock *blocks = (DecodedBlock *)realloc(dec->blocks, sizeof(DecodedBlock) * cap);
+        if (blocks == NULL) {
+            return DECODE_NO_BLOCK;
+        }
+        dec->blocks    = blocks;
+        dec->block_cap = cap;
+    }
+
+    int32_t b = (int32_t)dec->block_count++;
+    dec->blocks[b] = (DecodedBlock){.start = start, .words = words, .hash = hash};
+    for (uint32_t i = start; i < (uint32_t)start + words; i++) {
+        dec->block_at[i] = b;
+    }
+    return b;
+}
+
+// NOTE: a cached block is only trusted when mem still hashes the same and every record agrees with the opcode
+//       it sits on, otherwise it is dropped and the block gets decoded again
+static bool decode_install_pending(VM *vm, uint16_t pos) {
+    VmDecoded *dec = vm->decoded;
+    int32_t c = dec->pending[pos];
+    dec->pending[pos] = DECODE_NO_BLOCK;
+
+    const DecodeCacheHeader *header = (const DecodeCacheHeader *)dec->cache;
+    const DecodedBlock *block = (const DecodedBlock *)(dec->cache + sizeof(DecodeCacheHeader)) + c;
+    const DecodedInst *insts = (const DecodedInst *)((const DecodedBlock *)(dec->cache + sizeof(DecodeCacheHeader)) + header->block_count);
+    uint32_t end = (uint32_t)block->start + block->words;
+
+    for (uint32_t i = block->start; i < end; i++) {
+        if (dec->block_at[i] != DECODE_NO_BLOCK) {
+            return false;
+        }
+    }
+
+    if (vm_hash_mem(vm, block->start, (uint16_t)end) != block->hash) {
+        dec->stale++;
+        return false;
+    }
+
+    uint32_t p = block->start;
+    for (uint32_t i = 0; i < block->inst_count; i++, p += vm_inst_words(vm->mem[p])) {
+        const DecodedInst *inst = &insts[block->first_inst + i];
+        if (p >= end || !decode_inst_ok(inst, vm->mem[p])) {
+            dec->stale++;
+            return false;
+        }
+    }
+    if (p != end) {
+        dec->stale++;
+        return false;
+    }
+
+    if (decode_add_block(dec, block->start, block->words, block->hash) == DECODE_NO_BLOCK) {
+        return false;
+    }
+
+    p = block->start;
+    for (uint32_t i = 0; i < block->inst_count; i++, p += vm_inst_words(vm->mem[p])) {
+        dec->insts[p] = insts[block->first_inst + i];
+    }
+    dec->installed++;
+    return true;
+}
+
+static bool decode_block(VM *vm, uint16_t pos) {
+    VmDecoded *dec = vm->decoded;
+
+    // NOTE: pos lands inside the operands of an instruction that is already decoded
+    if (dec->block_at[pos] != DECODE_NO_BLOCK) {
+        return false;
+    }
+
+    if (dec->pending[pos] != DECODE_NO_BLOCK && decode_install_pending(vm, pos)) {
+        return true;
+    }
+
+    uint32_t p = pos;
+    while (p < MEM_SIZE) {
+        uint16_t op    = vm->mem[p];
+        uint32_t width = vm_inst_words(op);
+        bool     fits  = p + width <= MEM_SIZE;
+
+        for (uint32_t i = p; fits && i < p + width; i++) {
+            fits = dec->block_at[i] == DECODE_NO_BLOCK;
+        }
+        if (!fits) {
+            break;
+        }
+
+        p += width;
+        if (decode_ends_block(op)) {
+            break;
+        }
+    }
+
+    if (p == pos) {
+        return false;
+    }
+
+    if (decode_add_block(dec, pos, (uint16_t)(p - pos), vm_hash_mem(vm, pos, (uint16_t)p)) == DECODE_NO_BLOCK) {
+        return false;
+    }
+
+    for (uint32_t i = pos; i < p; i += vm_inst_words(vm->mem[i])) {
+        dec->insts[i] = decode_inst(vm, (uint16_t)i);
+    }
+    dec->decoded++;
+    return true;
+}
+
+void vm_decoded_invalidate(VM *vm, uint16_t addr) {
+    // NOTE: wmem trusts the guest with the address, anything past mem cannot hold decoded code
+    if (addr >= MEM_SIZE) {
+        return;
+    }
+
+    VmDecoded *dec = vm->decoded;
+    int32_t b = dec->block_at[addr];
+    if (b == DECODE_NO_BLOCK) {
+        return;
+    }
+
+    DecodedBlock *block = &dec->blocks[b];
+    for (uint32_t i = block->start; i < (uint32_t)block->start + block->words; i++) {
+        dec->insts[i].op = DECODE_NONE;
+        dec->block_at[i] = DECODE_NO_BLOCK;
+    }
+    block->words = 0;
+    dec->invalidated++;
+}
+
+// NOTE: args were checked to be below NUM_END, so this is the branchless vm_get_num without the NO_NUM clamp
+static inline uint16_t decode_num(VM *vm, uint16_t arg) {
+    uint16_t reg = vm->regs[(arg - MODULO) & (REG_COUNT - 1)];
+    return arg < MODULO ? arg : reg;
+}
+
+static inline void decode_step(VM *vm) {
+    const DecodedInst *inst = &vm->decoded->insts[vm->pos];
+    if (inst->op == DECODE_NONE && !decode_block(vm, vm->pos)) {
+        vm_next_inst(vm);
+        return;
+    }
+
+    // NOTE: operands were validated when decoding, but a register can still hold NO_NUM (rmem of 0xffff) and the
+    //       stack can be empty or full, those cases go back through vm_next_inst so its error handling stays the only one
+    Stack *stack = &vm->stack;
+    bool can_push = stack->status == STACK_OK && stack->index + 2 < stack->bufsize;
+    bool can_pop  = stack->status == STACK_OK && stack->index >= 0;
+    uint16_t a, b, c;
+    switch (inst->op) {
+        case 1: // set
+            b = decode_num(vm, inst->args[1]);
+            if (b == NO_NUM) {
+                break;
+            }
+            vm->regs[inst->args[0]] = b;
+            vm->pos += 3;
+            return;
+        case 2: // push
+            a = decode_num(vm, inst->args[0]);
+            if (a == NO_NUM || !can_push) {
+                break;
+            }
+            stack_push(stack, a);
+            vm->pos += 2;
+            return;
+        case 3: // pop
+            if (!can_pop) {
+                break;
+            }
+            vm->regs[inst->args[0]] = stack_pop(stack);
+            vm->pos += 2;
+            return;
+        case 4: // eq
+            b = decode_num(vm, inst->args[1]);
+            c = decode_num(vm, inst->args[2]);
+            if (b == NO_NUM || c == NO_NUM) {
+                break;
+            }
+            vm->regs[inst->args[0]] = b == c;
+            vm->pos += 4;
+            return;
+        case 5: // gt
+            b = decode_num(vm, inst->args[1]);
+            c = decode_num(vm, inst->args[2]);
+            if (b == NO_NUM || c == NO_NUM) {
+                break;
+            }
+            vm->regs[inst->args[0]] = b > c;
+            vm->pos += 4;
+            return;
+        case 6: // jmp
+            a = decode_num(vm, inst->args[0]);
+            if (a == NO_NUM) {
+                break;
+            }
+            vm->pos = a;
+            return;
+        case 7: // jt
+            a = decode_num(vm, inst->args[0]);
+            b = decode_num(vm, inst->args[1]);
+            if (a == NO_NUM || b == NO_NUM) {
+                break;
+            }
+            vm->pos = a != 0 ? b : vm->pos + 3;
+            return;
+        case 8: // jf
+            a = decode_num(vm, inst->args[0]);
+            b = decode_num(vm, inst->args[1]);
+            if (a == NO_NUM || b == NO_NUM) {
+                break;
+            }
+            vm->pos = a == 0 ? b : vm->pos + 3;
+            return;
+        case 9: // add
+            b = decode_num(vm, inst->args[1]);
+            c = decode_num(vm, inst->args[2]);
+            if (b == NO_NUM || c == NO_NUM) {
+                break;
+            }
+            vm->regs[inst->args[0]] = (b + c) % MODULO;
+            vm->pos += 4;
+            return;
+        case 10: // mult
+            b = decode_num(vm, inst->args[1]);
+            c = decode_num(vm, inst->args[2]);
+            if (b == NO_NUM || c == NO_NUM) {
+                break;
+            }
+            vm->regs[inst->args[0]] = (b * c) % MODULO;
+            vm->pos += 4;
+            return;
+        case 11: // mod
+            b = decode_num(vm, inst->args[1]);
+            c = decode_num(vm, inst->args[2]);
+            if (b == NO_NUM || c == NO_NUM) {
+                break;
+            }
+            vm->regs[inst->args[0]] = (b % c);
+            vm->pos += 4;
+            return;
+        case 12: // and
+            b = decode_num(vm, inst->args[1]);
+            c = decode_num(vm, inst->args[2]);
+            if (b == NO_NUM || c == NO_NUM) {
+                break;
+            }
+            vm->regs[inst->args[0]] = (b & c) % MODULO;
+            vm->pos += 4;
+            return;
+        case 13: // or
+            b = decode_num(vm, inst->args[1]);
+            c = decode_num(vm, inst->args[2]);
+            if (b == NO_NUM || c == NO_NUM) {
+                break;
+            }
+            vm->regs[inst->args[0]] = (b | c) % MODULO;
+            vm->pos += 4;
+            return;
+        case 14: // not
+            b = decode_num(vm, inst->args[1]);
+            if (b == NO_NUM) {
+                break;
+            }
+            vm->regs[inst->args[0]] = ((uint16_t)~b) % MODULO;
+            vm->pos += 3;
+            return;
+        case 15: // rmem
+            b = decode_num(vm, inst->args[1]);
+            if (b == NO_NUM) {
+                break;
+            }
+            vm->regs[inst->args[0]] = vm->mem[b];
+            vm->pos += 3;
+            return;
+        case 16: // wmem
+            a = decode_num(vm, inst->args[0]);
+            b = decode_num(vm, inst->args[1]);
+            if (a == NO_NUM || b == NO_NUM) {
+                break;
+            }
+            vm->mem[a] = b;
+            if (vm->hooks != NULL) {
+                vm_hooks_guard_write(vm, a);
+            }
+            vm->pos += 3;
+            // NOTE: may drop the block this very record lives in, nothing reads *inst* after this
+            vm_decoded_invalidate(vm, a);
+            return;
+        case 17: // call
+            a = decode_num(vm, inst->args[0]);
+            if (a == NO_NUM || !can_push || vm->hooks != NULL) {
+                break;
+            }
+            stack_push(stack, vm->pos + 2);
+            vm->pos = a;
+            return;
+        case 18: // ret
+            if (!can_pop) {
+                break;
+            }
+            vm->pos = stack_pop(stack);
+            return;
+        case 21: // noop
+            vm->pos += 1;
+            return;
+        default:
+            break;
+    }
+
+    vm_next_inst(vm);
+}
+
+uint32_t vm_run_decoded(VM *vm, uint32_t max_steps) {
+    uint32_t steps = 0;
+    while (steps < max_steps && vm->status == VM_OK && !vm->halt && vm->pos < MEM_SIZE) {
+        // NOTE: with metrics attached *in* goes back to vm_process first, which publishes before the read blocks
+        if (vm->metrics != NULL && steps > 0 && vm->mem[vm->pos] == 20) {
+            break;
+        }
+        decode_step(vm);
+        steps++;
+    }
+    return steps;
+}
+
+DecodeStatus decode_cache_load(VM *vm, const char *path, uint64_t binary_hash) {
+    VmDecoded *dec = vm->decoded;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return DECODE_OPEN_ERROR;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(DecodeCacheHeader)) {
+        close(fd);
+        return DECODE_BAD_HEADER_ERROR;
+    }
+
+    size_t size = (size_t)st.st_size;
+    const uint8_t *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return DECODE_MAP_ERROR;
+    }
+
+    const DecodeCacheHeader *header = (const DecodeCacheHeader *)base;
+    uint64_t need = sizeof(DecodeCacheHeader)
+        + (uint64_t)header->block_count * sizeof(DecodedBlock)
+        + (uint64_t)header->inst_count * sizeof(DecodedInst);
+
+    DecodeStatus status = DECODE_OK;
+    if (memcmp(header->magic, DECODE_CACHE_MAGIC, sizeof(DECODE_CACHE_MAGIC)) != 0
+        || header->version != DECODE_CACHE_VERSION
+        || header->header_size != sizeof(DecodeCacheHeader)
+        || need != size) {
+        status = DECODE_BAD_HEADER_ERROR;
+    } else if (header->binary_hash != binary_hash) {
+        status = DECODE_BINARY_MISMATCH_ERROR;
+    }
+
+    if (status != DECODE_OK) {
+        munmap((void *)base, size);
+        return status;
+    }
+
+    if (dec->cache != NULL) {
+        munmap((void *)dec->cache, dec->cache_size);
+    }
+    for (int i = 0; i < MEM_SIZE; i++) {
+        dec->pending[i] = DECODE_NO_BLOCK;
+    }
+    dec->cache      = base;
+    dec->cache_size = size;
+
+    // NOTE: blocks are only indexed here, their hashes are checked when execution first reaches them since
+    //       most of the code only exists after the guest decrypted it
+    const DecodedBlock *blocks = (const DecodedBlock *)(base + sizeof(DecodeCacheHeader));
+    for (uint32_t i = 0; i < header->block_count; i++) {
+        const DecodedBlock *block = &blocks[i];
+        if (block->words == 0
+            || (uint32_t)block->start + block->words > MEM_SIZE
+            || (uint64_t)block->first_inst + block->inst_count > header->inst_count) {
+            dec->stale++;
+            continue;
+        }
+        dec->pending[block->start] = (int32_t)i;
+    }
+
+    return DECODE_OK;
+}
+
+static bool decode_write(FILE *fp, const void *data, size_t size) {
+    return fwrite(data, 1, size, fp) == size;
+}
+
+DecodeStatus decode_cache_save(VM *vm, const char *path, uint64_t binary_hash) {
+    VmDecoded *dec = vm->decoded;
+
+    // NOTE: live blocks first, then cached blocks execution never reached this run (still valid for the next)
+    const DecodeCacheHeader *cache = (const DecodeCacheHeader *)dec->cache;
+    const DecodedBlock *cached_blocks = NULL;
+    const DecodedInst *cached_insts = NULL;
+    if (cache != NULL) {
+        cached_blocks = (const DecodedBlock *)(dec->cache + sizeof(DecodeCacheHeader));
+        cached_insts  = (const DecodedInst *)(cached_blocks + cache->block_count);
+    }
+
+    DecodeCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DECODE_CACHE_MAGIC, sizeof(DECODE_CACHE_MAGIC));
+    header.version     = DECODE_CACHE_VERSION;
+    header.header_size = sizeof(DecodeCacheHeader);
+    header.binary_hash = binary_hash;
+
+    DecodedBlock *blocks = (DecodedBlock *)malloc(sizeof(DecodedBlock) * (dec->block_count + MEM_SIZE));
+    if (blocks == NULL) {
+        return DECODE_ALLOCATION_FAIL_ERROR;
+    }
+
+    for (uint32_t b = 0; b < dec->block_count; b++) {
+        DecodedBlock block = dec->blocks[b];
+        if (block.words == 0) {
+            continue;
+        }
+
+        block.first_inst = header.inst_count;
+        block.inst_count = 0;
+        for (uint32_t p = block.start; p < (uint32_t)block.start + block.words; p += vm_inst_words(vm->mem[p])) {
+            block.inst_count++;
+        }
+        header.inst_count += block.inst_count;
+        blocks[header.block_count++] = block;
+    }
+    uint32_t live = header.block_count;
+
+    for (int p = 0; p < MEM_SIZE; p++) {
+        if (dec->pending[p] == DECODE_NO_BLOCK || dec->block_at[p] != DECODE_NO_BLOCK) {
+            continue;
+        }
+
+        DecodedBlock block = cached_blocks[dec->pending[p]];
+        block.first_inst = header.inst_count;
+        header.inst_count += block.inst_count;
+        blocks[header.block_count++] = block;
+    }
+
+    // NOTE: write next to the target and rename, so a crash never leaves a half written cache behind
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        free(blocks);
+        return DECODE_OPEN_ERROR;
+    }
+
+    bool ok = decode_write(fp, &header, sizeof(header))
+        && decode_write(fp, blocks, sizeof(DecodedBlock) * header.block_count);
+
+    for (uint32_t b = 0; ok && b < header.block_count; b++) {
+        const DecodedBlock *block = &blocks[b];
+        if (b < live) {
+            for (uint32_t p = block->start; ok && p < (uint32_t)block->start + block->words; p += vm_inst_words(vm->mem[p])) {
+                ok = decode_write(fp, &dec->insts[p], sizeof(DecodedInst));
+            }
+        } else {
+            const DecodedBlock *src = &cached_blocks[dec->pending[block->start]];
+            ok = decode_write(fp, &cached_insts[src->first_inst], sizeof(DecodedInst) * src->inst_count);
+        }
+    }
+
+    ok = fclose(fp) == 0 && ok;
+    free(blocks);
+
+    if (!ok || rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        return DECODE_WRITE_ERROR;
+    }
+    return DECODE_OK;
+}
+
+void vm_decoded_print_stats(VM *vm, FILE *fp) {
+    VmDecoded *dec = vm->decoded;
+    fprintf(fp, "decode: decoded %lu, from cache %lu, stale %lu, invalidated %lu\n",
+            (unsigned long)dec->decoded, (unsigned long)dec->installed,
+            (unsigned long)dec->stale, (unsigned long)dec->invalidated);
+}
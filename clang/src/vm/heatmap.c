@@ -0,0 +1,180 @@
+#include <string.h>
+#include "../../include/heatmap.h"
+
+static const char *heatmap_error_msgs[] = {
+#define X(name, value) [name] = value,
+    HEATMAP_STATE_LIST(X)
+#undef X
+};
+
+static const char *heatmap_flag_names[] = {
+#define X(name, value) [name] = value,
+    HEATMAP_FLAG_LIST(X)
+#undef X
+};
+
+const char *heatmap_get_error_msg(HeatmapStatus status) {
+    switch (status) {
+#define X(name, value) case name: return heatmap_error_msgs[name];
+        HEATMAP_STATE_LIST(X)
+#undef X
+        default:
+            return "undefined heatmap status value";
+    }
+}
+
+bool vm_heatmap_attach(VM *vm) {
+    if (vm->status != VM_OK) {
+        return false;
+    }
+
+    VmHeatmap *map = (VmHeatmap *)calloc(1, sizeof(VmHeatmap));
+    if (map == NULL) {
+        return false;
+    }
+
+    vm_heatmap_detach(vm);
+    vm->heatmap = map;
+    return true;
+}
+
+void vm_heatmap_detach(VM *vm) {
+    if (vm->heatmap == NULL) {
+        return;
+    }
+
+    free(vm->heatmap);
+    vm->heatmap = NULL;
+}
+
+static void heatmap_fill_header(HeatmapHeader *header) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, HEATMAP_MAGIC, sizeof(HEATMAP_MAGIC));
+    header->version       = HEATMAP_VERSION;
+    header->header_size   = sizeof(HeatmapHeader);
+    header->mem_words     = MEM_SIZE;
+    header->flag_count    = HEATMAP_FLAG_COUNT;
+    header->bits_offset   = sizeof(HeatmapHeader);
+    header->counts_offset = sizeof(HeatmapHeader) + sizeof(((VmHeatmap *)0)->bits);
+}
+
+HeatmapStatus heatmap_save(const VmHeatmap *map, const char *path) {
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) {
+        return HEATMAP_OPEN_ERROR;
+    }
+
+    HeatmapHeader header;
+    heatmap_fill_header(&header);
+
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1
+        && fwrite(map->bits, sizeof(map->bits), 1, fp) == 1
+        && fwrite(map->counts, sizeof(map->counts), 1, fp) == 1;
+
+    if (fclose(fp) != 0) {
+        ok = false;
+    }
+    return ok ? HEATMAP_OK : HEATMAP_WRITE_ERROR;
+}
+
+HeatmapStatus heatmap_load(VmHeatmap *map, const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return HEATMAP_OPEN_ERROR;
+    }
+
+    HeatmapHeader expected, header;
+    heatmap_fill_header(&expected);
+
+    HeatmapStatus status = HEATMAP_OK;
+    if (fread(&header, sizeof(header), 1, fp) != 1) {
+        status = HEATMAP_READ_ERROR;
+    } else if (memcmp(&header, &expected, sizeof(header)) != 0) {
+        status = HEATMAP_BAD_HEADER_ERROR;
+    } else if (fread(map->bits, sizeof(map->bits), 1, fp) != 1
+            || fread(map->counts, sizeof(map->counts), 1, fp) != 1) {
+        status = HEATMAP_READ_ERROR;
+    }
+
+    fclose(fp);
+    return status;
+}
+
+static void heatmap_report_top(const VmHeatmap *map, HeatmapFlag flag, FILE *fp) {
+    uint16_t top[HEATMAP_TOP];
+    int n = 0;
+
+    // NOTE: insertion into a small sorted array, the map is only 32K words
+    for (int addr = 0; addr < MEM_SIZE; addr++) {
+        uint32_t count = map->counts[flag][addr];
+        if (count == 0) {
+            continue;
+        }
+
+        int i = n < HEATMAP_TOP ? n++ : HEATMAP_TOP;
+        while (i > 0 && map->counts[flag][top[i - 1]] < count) {
+            if (i < HEATMAP_TOP) {
+                top[i] = top[i - 1];
+            }
+            i--;
+        }
+        if (i < HEATMAP_TOP) {
+            top[i] = (uint16_t)addr;
+        }
+    }
+
+    fprintf(fp, "\nhottest %s addresses:\n", heatmap_flag_names[flag]);
+    for (int i = 0; i < n; i++) {
+        fprintf(fp, "  %5d: %u\n", top[i], map->counts[flag][top[i]]);
+    }
+}
+
+void heatmap_report(const VmHeatmap *map, FILE *fp) {
+    int code = 0, data = 0, smc = 0, untouched = 0;
+    int flags[HEATMAP_FLAG_COUNT] = {0};
+
+    for (int addr = 0; addr < MEM_SIZE; addr++) {
+        for (int flag = 0; flag < HEATMAP_FLAG_COUNT; flag++) {
+            flags[flag] += heatmap_has(map, flag, addr);
+        }
+
+        bool exec = heatmap_has(map, HEATMAP_EXEC, addr);
+        bool used = heatmap_has(map, HEATMAP_READ, addr) || heatmap_has(map, HEATMAP_WRITE, addr);
+        if (heatmap_has(map, HEATMAP_WRITE_EXEC, addr)) {
+            smc++;
+        } else if (exec) {
+            code++;
+        } else if (used) {
+            data++;
+        } else {
+            untouched++;
+        }
+    }
+
+    fprintf(fp, "words: %d\n", MEM_SIZE);
+    fprintf(fp, "code : %d\n", code);
+    fprintf(fp, "data : %d\n", data);
+    fprintf(fp, "smc  : %d (written then executed)\n", smc);
+    fprintf(fp, "none : %d\n", untouched);
+
+    fprintf(fp, "\nwords per flag:\n");
+    for (int flag = 0; flag < HEATMAP_FLAG_COUNT; flag++) {
+        fprintf(fp, "  %-22s %d\n", heatmap_flag_names[flag], flags[flag]);
+    }
+
+    for (int flag = 0; flag < HEATMAP_WRITE_EXEC; flag++) {
+        heatmap_report_top(map, flag, fp);
+    }
+
+    fprintf(fp, "\nwritten then executed ranges:\n");
+    for (int addr = 0; addr < MEM_SIZE; addr++) {
+        if (!heatmap_has(map, HEATMAP_WRITE_EXEC, addr)) {
+            continue;
+        }
+        int start = addr;
+        while (addr + 1 < MEM_SIZE && heatmap_has(map, HEATMAP_WRITE_EXEC, addr + 1)) {
+            addr++;
+        }
+        fprintf(fp, "  %5d..%5d\n", start, addr);
+    }
+}
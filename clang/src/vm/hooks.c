@@ -0,0 +1,374 @@
+#define _POSIX_C_SOURCE 200809L
+#include <string.h>
+#include "../../include/hooks.h"
+#include "../../include/decode.h"
+#include "../../include/metrics.h"
+
+// NOTE: guest routines in challenge.bin the native code below stands in for (see data/dism.txt)
+#define GUEST_OUT_CB      1528 // out r0
+#define GUEST_XOR_OUT_CB  1531 // out r0 ^ r2
+#define GUEST_CMP_CB      1619 // compare r0 with the r1th word of the string at r2, stop foreach on mismatch
+#define GUEST_DECRYPT_LO  6068
+#define GUEST_DECRYPT_HI  30050
+#define GUEST_DECRYPT_KEY 16724
+
+typedef bool (*HookFn)(VM *vm, VmHooks *hooks);
+
+static bool hook_foreach(VM *vm, VmHooks *hooks);
+static bool hook_print(VM *vm, VmHooks *hooks);
+static bool hook_decrypt(VM *vm, VmHooks *hooks);
+static bool hook_xor(VM *vm, VmHooks *hooks);
+
+static const char *hook_names[] = {
+#define X(name, label, target, hash) [name] = label,
+    HOOK_LIST(X)
+#undef X
+};
+
+static const uint16_t hook_targets[] = {
+#define X(name, label, target, hash) [name] = target,
+    HOOK_LIST(X)
+#undef X
+};
+
+static const uint64_t hook_hashes[] = {
+#define X(name, label, target, hash) [name] = hash,
+    HOOK_LIST(X)
+#undef X
+};
+
+static const HookFn hook_fns[] = {
+    [HOOK_FOREACH] = hook_foreach,
+    [HOOK_PRINT]   = hook_print,
+    [HOOK_DECRYPT] = hook_decrypt,
+    [HOOK_XOR]     = hook_xor,
+};
+
+// NOTE: every word the native version relies on, callees included, an empty range ends the list
+static const HookRange hook_ranges[][HOOK_MAX_RANGES] = {
+    [HOOK_FOREACH] = {{1458, 1543}, {1619, 1648}, {2125, 2149}},
+    [HOOK_PRINT]   = {{1458, 1531}},
+    [HOOK_DECRYPT] = {{1723, 1767}, {2125, 2149}},
+    [HOOK_XOR]     = {{2125, 2149}},
+};
+
+static void hook_out(VM *vm, VmHooks *hooks, uint16_t ch) {
+    fprintf(hooks->out != NULL ? hooks->out : stdout, "%c", ch);
+    if (vm->metrics != NULL) {
+        vm_metrics_count_out(vm);
+    }
+}
+
+static void hook_write(VM *vm, VmHooks *hooks, uint16_t addr, uint16_t val) {
+    vm->mem[addr] = val;
+    if (hooks->guard[addr / 8] & (1 << (addr % 8))) {
+        hooks->dirty = true;
+    }
+    if (vm->decoded != NULL) {
+        vm_decoded_invalidate(vm, addr);
+    }
+}
+
+// NOTE: the and/not/or sequence of 2125, kept op for op so values with bit 15 set behave the same
+static uint16_t guest_xor(uint16_t a, uint16_t b) {
+    uint16_t t = (a & b) % MODULO;
+    t = ((uint16_t)~t) % MODULO;
+    a = (a | b) % MODULO;
+    return (a & t) % MODULO;
+}
+
+static bool hook_known_callback(uint16_t cb) {
+    return cb == GUEST_OUT_CB || cb == GUEST_XOR_OUT_CB || cb == GUEST_CMP_CB;
+}
+
+// NOTE: 1458 calls r1 for every word of the length prefixed string at r0, r1 is left as the loop counter
+static void guest_foreach(VM *vm, VmHooks *hooks) {
+    uint16_t *r = vm->regs;
+    uint16_t s0 = r[0], s3 = r[3], s4 = r[4], s5 = r[5], s6 = r[6];
+
+    r[6] = r[0];
+    r[5] = r[1];
+    r[4] = vm->mem[r[0]];
+    r[1] = 0;
+
+    for (;;) {
+        r[3] = (1 + r[1]) % MODULO;
+        if (r[3] > r[4]) {
+            break;
+        }
+        r[3] = (r[3] + r[6]) % MODULO;
+        r[0] = vm->mem[r[3]];
+
+        switch (r[5]) {
+            case GUEST_OUT_CB:
+                hook_out(vm, hooks, r[0]);
+                break;
+            case GUEST_XOR_OUT_CB:
+                r[0] = guest_xor(r[0], r[2]);
+                hook_out(vm, hooks, r[0]);
+                break;
+            case GUEST_CMP_CB: {
+                uint16_t addr = (uint16_t)((((r[2] + 1) % MODULO) + r[1]) % MODULO);
+                if (r[0] != vm->mem[addr]) {
+                    r[2] = r[1];
+                    r[1] = MODULO - 1;
+                }
+                break;
+            }
+        }
+
+        r[1] = (r[1] + 1) % MODULO;
+        if (r[1] == 0) {
+            break;
+        }
+    }
+
+    r[0] = s0;
+    r[3] = s3;
+    r[4] = s4;
+    r[5] = s5;
+    r[6] = s6;
+}
+
+static bool hook_foreach(VM *vm, VmHooks *hooks) {
+    if (!hook_known_callback(vm->regs[1])) {
+        return false;
+    }
+    guest_foreach(vm, hooks);
+    return true;
+}
+
+static bool hook_print(VM *vm, VmHooks *hooks) {
+    uint16_t s1 = vm->regs[1];
+    vm->regs[1] = GUEST_OUT_CB;
+    guest_foreach(vm, hooks);
+    vm->regs[1] = s1;
+    return true;
+}
+
+static bool hook_decrypt(VM *vm, VmHooks *hooks) {
+    uint16_t addr = GUEST_DECRYPT_LO;
+    do {
+        uint16_t val = guest_xor(vm->mem[addr], (uint16_t)((addr * addr) % MODULO));
+        hook_write(vm, hooks, addr, guest_xor(val, GUEST_DECRYPT_KEY));
+        addr = (addr + 1) % MODULO;
+    } while (addr != GUEST_DECRYPT_HI);
+    return true;
+}
+
+static bool hook_xor(VM *vm, VmHooks *hooks) {
+    (void)hooks;
+    vm->regs[0] = guest_xor(vm->regs[0], vm->regs[1]);
+    return true;
+}
+
+static uint64_t hooks_hash(VM *vm, HookId id) {
+    uint64_t h = 0;
+    for (int i = 0; i < HOOK_MAX_RANGES && hook_ranges[id][i].end != 0; i++) {
+        h = ((h << 1) | (h >> 63)) ^ vm_hash_mem(vm, hook_ranges[id][i].start, hook_ranges[id][i].end);
+    }
+    return h;
+}
+
+static void hooks_verify(VM *vm, VmHooks *hooks) {
+    memset(hooks->guard, 0, sizeof(hooks->guard));
+
+    for (int id = 0; id < HOOK_COUNT; id++) {
+        if (hooks->enabled[id] && hooks_hash(vm, id) != hook_hashes[id]) {
+            hooks->enabled[id] = false;
+        }
+        if (!hooks->enabled[id]) {
+            continue;
+        }
+        for (int i = 0; i < HOOK_MAX_RANGES && hook_ranges[id][i].end != 0; i++) {
+            for (uint16_t addr = hook_ranges[id][i].start; addr < hook_ranges[id][i].end; addr++) {
+                hooks->guard[addr / 8] |= (uint8_t)(1 << (addr % 8));
+            }
+        }
+    }
+
+    hooks->dirty = false;
+}
+
+bool vm_hooks_attach(VM *vm, bool check) {
+    if (vm->status != VM_OK) {
+        return false;
+    }
+
+    VmHooks *hooks = (VmHooks *)calloc(1, sizeof(VmHooks));
+    if (hooks == NULL) {
+        return false;
+    }
+
+    hooks->check = check;
+    if (check) {
+        hooks->shadow[0] = vm_init(vm->should_skip_on_reg_or_num_err);
+        hooks->shadow[1] = vm_init(vm->should_skip_on_reg_or_num_err);
+        if (hooks->shadow[0] == NULL || hooks->shadow[1] == NULL) {
+            vm_free(hooks->shadow[0]);
+            vm_free(hooks->shadow[1]);
+            free(hooks);
+            return false;
+        }
+    }
+
+    for (int id = 0; id < HOOK_COUNT; id++) {
+        hooks->slot[hook_targets[id]] = (uint8_t)(id + 1);
+        hooks->enabled[id] = true;
+    }
+
+    vm_hooks_detach(vm);
+    vm->hooks = hooks;
+    hooks_verify(vm, hooks);
+    return true;
+}
+
+void vm_hooks_detach(VM *vm) {
+    if (vm->hooks == NULL) {
+        return;
+    }
+
+    vm_free(vm->hooks->shadow[0]);
+    vm_free(vm->hooks->shadow[1]);
+    free(vm->hooks);
+    vm->hooks = NULL;
+}
+
+void vm_hooks_guard_write(VM *vm, uint16_t addr) {
+    if (vm->hooks->guard[addr / 8] & (1 << (addr % 8))) {
+        vm->hooks->dirty = true;
+    }
+}
+
+static bool hooks_clone(VM *dst, VM *src) {
+    memcpy(dst->regs, src->regs, sizeof(dst->regs));
+    memcpy(dst->mem, src->mem, sizeof(dst->mem));
+    dst->pos    = src->pos;
+    dst->halt   = src->halt;
+    dst->status = src->status;
+
+    dst->stack.index  = -1;
+    dst->stack.status = STACK_OK;
+    for (int i = 0; i <= src->stack.index; i++) {
+        stack_push(&dst->stack, ((uint16_t *)src->stack.buf)[i]);
+    }
+    return dst->stack.status == STACK_OK;
+}
+
+// NOTE: runs the *call* at vm->pos through the interpreter until it returns, output goes to *fp*
+static bool hooks_interpret_call(VM *vm, FILE *fp) {
+    uint16_t ret   = vm->pos + 2;
+    int      depth = vm->stack.index;
+
+    vm_next_inst(vm);
+    for (long steps = 0; steps < HOOK_CHECK_STEP_LIMIT; steps++) {
+        if (vm->status != VM_OK || vm->halt || vm->pos >= MEM_SIZE) {
+            return false;
+        }
+        if (vm->pos == ret && vm->stack.index == depth) {
+            return true;
+        }
+
+        switch (vm->mem[vm->pos]) {
+            case 19: // out
+                fprintf(fp, "%c", vm_get_num(vm, vm->mem[vm->pos + 1]));
+                vm->pos += 2;
+                break;
+            case 20: // in, hooked routines never read input
+                return false;
+            default:
+                vm_next_inst(vm);
+                break;
+        }
+    }
+    return false;
+}
+
+static bool hooks_same_state(VM *a, VM *b) {
+    return a->pos == b->pos
+        && a->stack.index == b->stack.index
+        && memcmp(a->regs, b->regs, sizeof(a->regs)) == 0
+        && memcmp(a->mem, b->mem, sizeof(a->mem)) == 0
+        && memcmp(a->stack.buf, b->stack.buf, sizeof(uint16_t) * (a->stack.index + 1)) == 0;
+}
+
+static bool hooks_check(VM *vm, VmHooks *hooks, HookId id) {
+    VM *interp = hooks->shadow[0];
+    VM *native = hooks->shadow[1];
+    if (!hooks_clone(interp, vm) || !hooks_clone(native, vm)) {
+        return false;
+    }
+
+    char *interp_out = NULL, *native_out = NULL;
+    size_t interp_len = 0, native_len = 0;
+
+    FILE *fp = open_memstream(&interp_out, &interp_len);
+    if (fp == NULL) {
+        return false;
+    }
+    bool ran = hooks_interpret_call(interp, fp);
+    fclose(fp);
+
+    fp = open_memstream(&native_out, &native_len);
+    if (fp == NULL) {
+        free(interp_out);
+        return false;
+    }
+    hooks->out = fp;
+    bool handled = hook_fns[id](native, hooks);
+    native->pos += 2;
+    hooks->out = NULL;
+    fclose(fp);
+
+    bool same = ran && hooks_same_state(interp, native)
+        && interp_len == native_len && memcmp(interp_out, native_out, interp_len) == 0;
+
+    free(interp_out);
+    free(native_out);
+
+    if (handled && !same) {
+        fprintf(stderr, "hook %s at %d does not match the interpreter, disabled\n", hook_names[id], hook_targets[id]);
+        hooks->enabled[id] = false;
+        hooks_verify(vm, hooks);
+    }
+    return handled && same;
+}
+
+bool vm_hooks_call(VM *vm, uint16_t target) {
+    VmHooks *hooks = vm->hooks;
+    // NOTE: native code would hide the guest's own accesses from the heatmap
+    if (target >= MEM_SIZE || hooks->slot[target] == 0 || vm->heatmap != NULL) {
+        return false;
+    }
+
+    if (hooks->dirty) {
+        hooks_verify(vm, hooks);
+    }
+
+    HookId id = (HookId)(hooks->slot[target] - 1);
+    if (!hooks->enabled[id]) {
+        return false;
+    }
+
+    if (hooks->check && !hooks_check(vm, hooks, id)) {
+        return false;
+    }
+
+    if (!hook_fns[id](vm, hooks)) {
+        return false;
+    }
+
+    hooks->native_calls[id]++;
+    return true;
+}
+
+void vm_hooks_print_stats(VM *vm, FILE *fp) {
+    if (vm->hooks == NULL) {
+        return;
+    }
+
+    for (int id = 0; id < HOOK_COUNT; id++) {
+        fprintf(fp, "hook %-8s at %5d: %s, native calls: %lu\n", hook_names[id], hook_targets[id],
+                vm->hooks->enabled[id] ? "enabled" : "disabled", (unsigned long)vm->hooks->native_calls[id]);
+    }
+}
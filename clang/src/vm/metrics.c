@@ -0,0 +1,107 @@
+#define _POSIX_C_SOURCE 200809L
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../../include/metrics.h"
+
+uint64_t metrics_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+bool vm_metrics_attach(VM *vm, const char *path) {
+    if (vm->status != VM_OK) {
+        return false;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    if (ftruncate(fd, sizeof(VmMetrics)) != 0) {
+        close(fd);
+        return false;
+    }
+
+    VmMetrics *metrics = mmap(NULL, sizeof(VmMetrics), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (metrics == MAP_FAILED) {
+        return false;
+    }
+
+    uint64_t now = metrics_now_ns();
+    memcpy(metrics->magic, METRICS_MAGIC, sizeof(METRICS_MAGIC));
+    metrics->version = METRICS_VERSION;
+    metrics->pid     = (uint32_t)getpid();
+    atomic_store_explicit(&metrics->started_ns, now, memory_order_relaxed);
+    atomic_store_explicit(&metrics->updated_ns, now, memory_order_relaxed);
+    atomic_store_explicit(&metrics->running, 1, memory_order_relaxed);
+
+    vm_metrics_detach(vm);
+    vm->metrics = metrics;
+    return true;
+}
+
+void vm_metrics_detach(VM *vm) {
+    if (vm->metrics == NULL) {
+        return;
+    }
+
+    atomic_store_explicit(&vm->metrics->running, 0, memory_order_relaxed);
+    munmap(vm->metrics, sizeof(VmMetrics));
+    vm->metrics = NULL;
+}
+
+void vm_metrics_publish(VM *vm, uint64_t instructions) {
+    VmMetrics *metrics = vm->metrics;
+    atomic_fetch_add_explicit(&metrics->instructions, instructions, memory_order_relaxed);
+    atomic_store_explicit(&metrics->stack_depth, (uint64_t)(vm->stack.index + 1), memory_order_relaxed);
+    atomic_store_explicit(&metrics->stack_peak, (uint64_t)(vm->stack.peak + 1), memory_order_relaxed);
+    atomic_store_explicit(&metrics->updated_ns, metrics_now_ns(), memory_order_relaxed);
+}
+
+void vm_metrics_count_in(VM *vm, uint64_t blocked_since_ns, bool got) {
+    atomic_fetch_add_explicit(&vm->metrics->in_bytes, got, memory_order_relaxed);
+    atomic_fetch_add_explicit(&vm->metrics->in_blocked_ns, metrics_now_ns() - blocked_since_ns, memory_order_relaxed);
+}
+
+void vm_metrics_count_out(VM *vm) {
+    atomic_fetch_add_explicit(&vm->metrics->out_bytes, 1, memory_order_relaxed);
+}
+
+VmMetrics *metrics_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(VmMetrics)) {
+        close(fd);
+        return NULL;
+    }
+
+    VmMetrics *metrics = mmap(NULL, sizeof(VmMetrics), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (metrics == MAP_FAILED) {
+        return NULL;
+    }
+
+    if (memcmp(metrics->magic, METRICS_MAGIC, sizeof(METRICS_MAGIC)) != 0 || metrics->version != METRICS_VERSION) {
+        munmap(metrics, sizeof(VmMetrics));
+        return NULL;
+    }
+
+    return metrics;
+}
+
+void metrics_close(VmMetrics *metrics) {
+    if (metrics != NULL) {
+        munmap(metrics, sizeof(VmMetrics));
+    }
+}
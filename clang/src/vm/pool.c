@@ -0,0 +1,205 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "../../include/pool.h"
+#include "../../include/hooks.h"
+#include "../../include/heatmap.h"
+#include "../../include/metrics.h"
+#include "../../include/decode.h"
+
+static const char *pool_mode_names[] = {
+#define X(name, value) [name] = value,
+    POOL_MODE_LIST(X)
+#undef X
+};
+
+const char *vm_pool_mode_name(PoolMode mode) {
+    switch (mode) {
+#define X(name, value) case name: return pool_mode_names[name];
+        POOL_MODE_LIST(X)
+#undef X
+        default:
+            return "undefined pool mode value";
+    }
+}
+
+static size_t pool_round(size_t size, size_t to) {
+    return (size + to - 1) / to * to;
+}
+
+static bool pool_map_arena(VmPool *pool) {
+    if (pool->mode == POOL_COPY) {
+        size_t huge_size = pool_round(pool->arena_size, POOL_HUGE_PAGE);
+        void *arena = mmap(NULL, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (arena != MAP_FAILED) {
+            pool->arena      = arena;
+            pool->arena_size = huge_size;
+            pool->huge       = true;
+            return true;
+        }
+    }
+
+    void *arena = mmap(NULL, pool->arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena == MAP_FAILED) {
+        return false;
+    }
+    if (pool->mode == POOL_COPY) {
+        madvise(arena, pool->arena_size, MADV_HUGEPAGE);
+    }
+    pool->arena = arena;
+    return true;
+}
+
+// NOTE: the memfd holds one slot worth of pristine bytes, every slot is a private mapping of it
+static bool pool_map_image(VmPool *pool) {
+    pool->memfd = memfd_create("vm-pool-image", MFD_CLOEXEC);
+    if (pool->memfd < 0 || ftruncate(pool->memfd, pool->slot_size) != 0) {
+        return false;
+    }
+
+    void *image = mmap(NULL, pool->slot_size, PROT_READ | PROT_WRITE, MAP_SHARED, pool->memfd, 0);
+    if (image == MAP_FAILED) {
+        return false;
+    }
+    memcpy(image, pool->pristine, sizeof(VM));
+    munmap(image, pool->slot_size);
+    return true;
+}
+
+static VM *pool_slot(VmPool *pool, int slot) {
+    return (VM *)(pool->arena + (size_t)slot * pool->slot_size);
+}
+
+static bool pool_map_slots(VmPool *pool) {
+    for (int slot = 0; slot < pool->capacity; slot++) {
+        void *mapped = mmap(pool_slot(pool, slot), pool->slot_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, pool->memfd, 0);
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+    }
+    return true;
+}
+
+VmPool *vm_pool_init(VM *image, int capacity, PoolMode mode) {
+    if (image->status != VM_OK || capacity <= 0) {
+        return NULL;
+    }
+
+    VmPool *pool = (VmPool *)calloc(1, sizeof(VmPool));
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    pool->mode       = mode;
+    pool->capacity   = capacity;
+    pool->memfd      = -1;
+    pool->slot_size  = pool_round(sizeof(VM), (size_t)sysconf(_SC_PAGESIZE));
+    pool->arena_size = pool->slot_size * capacity;
+
+    bool ok = (pool->pristine = (VM *)aligned_alloc(CACHE_LINE, sizeof(VM))) != NULL
+        && (pool->stacks = (Stack *)calloc(capacity, sizeof(Stack))) != NULL
+        && (pool->free_slots = (int *)calloc(capacity, sizeof(int))) != NULL
+        && (pool->pristine_stack = (uint16_t *)malloc(sizeof(uint16_t) * (image->stack.index + 1) + 1)) != NULL;
+
+    if (ok) {
+        // NOTE: the image keeps its own heap stack and attachments, slots only ever see a neutral copy
+        memcpy(pool->pristine, image, sizeof(VM));
+        memset(&pool->pristine->stack, 0, sizeof(Stack));
+        pool->pristine->stack.index  = -1;
+        pool->pristine->stack.peak   = -1;
+        pool->pristine->hooks        = NULL;
+        pool->pristine->heatmap      = NULL;
+        pool->pristine->metrics      = NULL;
+        pool->pristine->decoded      = NULL;
+        pool->pristine_depth         = image->stack.index + 1;
+        memcpy(pool->pristine_stack, image->stack.buf, sizeof(uint16_t) * pool->pristine_depth);
+    }
+
+    ok = ok && pool_map_arena(pool) && (mode != POOL_COW || (pool_map_image(pool) && pool_map_slots(pool)));
+    for (int i = 0; ok && i < capacity; i++) {
+        ok = stack_setup(&pool->stacks[i]);
+        pool->free_slots[i] = capacity - 1 - i;
+    }
+
+    if (!ok) {
+        vm_pool_free(pool);
+        return NULL;
+    }
+
+    pool->free_count = capacity;
+    return pool;
+}
+
+void vm_pool_free(VmPool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    if (pool->stacks != NULL) {
+        for (int i = 0; i < pool->capacity; i++) {
+            stack_teardown(&pool->stacks[i]);
+        }
+        free(pool->stacks);
+    }
+
+    if (pool->arena != NULL) {
+        munmap(pool->arena, pool->arena_size);
+    }
+    if (pool->memfd >= 0) {
+        close(pool->memfd);
+    }
+
+    free(pool->pristine);
+    free(pool->pristine_stack);
+    free(pool->free_slots);
+    free(pool);
+}
+
+VM *vm_pool_acquire(VmPool *pool) {
+    if (pool->free_count == 0) {
+        return NULL;
+    }
+
+    int slot = pool->free_slots[--pool->free_count];
+    VM *vm   = pool_slot(pool, slot);
+
+    // NOTE: a free POOL_COW slot already reads as the image, its private pages were dropped on release
+    if (pool->mode == POOL_COPY) {
+        memcpy(vm, pool->pristine, sizeof(VM));
+    }
+
+    vm->stack        = pool->stacks[slot];
+    vm->stack.index  = -1;
+    vm->stack.peak   = -1;
+    vm->stack.status = STACK_OK;
+    for (int i = 0; i < pool->pristine_depth && vm->stack.status == STACK_OK; i++) {
+        stack_push(&vm->stack, pool->pristine_stack[i]);
+    }
+
+    // NOTE: a half restored stack is not a pristine instance, keep the (possibly grown) buffer and give the slot back
+    if (vm->stack.status != STACK_OK) {
+        pool->stacks[slot] = vm->stack;
+        pool->free_slots[pool->free_count++] = slot;
+        return NULL;
+    }
+    return vm;
+}
+
+void vm_pool_release(VmPool *pool, VM *vm) {
+    int slot = (int)(((uint8_t *)vm - pool->arena) / pool->slot_size);
+
+    vm_hooks_detach(vm);
+    vm_heatmap_detach(vm);
+    vm_metrics_detach(vm);
+    vm_decoded_detach(vm);
+
+    // NOTE: keep the (possibly grown) stack buffer for the next session in this slot
+    pool->stacks[slot] = vm->stack;
+    pool->free_slots[pool->free_count++] = slot;
+
+    // NOTE: the reset, dropping the private copies makes every page of the slot read from the image again
+    if (pool->mode == POOL_COW) {
+        madvise(vm, pool->slot_size, MADV_DONTNEED);
+    }
+}
@@ -0,0 +1,219 @@
+#define _DEFAULT_SOURCE
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../../include/snapshot.h"
+
+static const char *snapshot_error_msgs[] = {
+#define X(name, value) [name] = value,
+    SNAPSHOT_STATE_LIST(X)
+#undef X
+};
+
+const char *snapshot_get_error_msg(SnapshotStatus status) {
+    switch (status) {
+#define X(name, value) case name: return snapshot_error_msgs[name];
+        SNAPSHOT_STATE_LIST(X)
+#undef X
+        default:
+            return "undefined snapshot status value";
+    }
+}
+
+SnapshotStatus snapshot_hash_file(const char *path, uint64_t *hash) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return SNAPSHOT_BINARY_READ_ERROR;
+    }
+
+    uint64_t h = 14695981039346656037ULL;
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            h ^= buf[i];
+            h *= 1099511628211ULL;
+        }
+    }
+
+    bool failed = ferror(fp);
+    fclose(fp);
+    if (failed) {
+        return SNAPSHOT_BINARY_READ_ERROR;
+    }
+
+    *hash = h;
+    return SNAPSHOT_OK;
+}
+
+static bool snapshot_write_at(FILE *fp, uint32_t offset, const void *data, size_t size) {
+    if (fseek(fp, offset, SEEK_SET) != 0) {
+        return false;
+    }
+    return size == 0 || fwrite(data, 1, size, fp) == size;
+}
+
+SnapshotStatus snapshot_save(VM *vm, const char *path, uint64_t binary_hash, const char *out, uint32_t out_bytes) {
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version      = SNAPSHOT_VERSION;
+    header.header_size  = sizeof(SnapshotHeader);
+    header.binary_hash  = binary_hash;
+    header.mem_offset   = SNAPSHOT_PAGE;
+    header.mem_words    = MEM_SIZE;
+    header.regs_offset  = header.mem_offset + sizeof(uint16_t) * MEM_SIZE;
+    header.reg_count    = REG_COUNT;
+    header.stack_offset = header.regs_offset + sizeof(vm->regs);
+    header.stack_words  = (uint32_t)(vm->stack.index + 1);
+    header.out_offset   = header.stack_offset + header.stack_words * sizeof(uint16_t);
+    header.out_bytes    = out_bytes;
+    header.pos          = vm->pos;
+    header.halt         = vm->halt;
+
+    // NOTE: write next to the target and rename, so a crash never leaves a half written snapshot behind
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        return SNAPSHOT_OPEN_ERROR;
+    }
+
+    bool ok = snapshot_write_at(fp, 0, &header, sizeof(header))
+        && snapshot_write_at(fp, header.mem_offset, vm->mem, sizeof(uint16_t) * MEM_SIZE)
+        && snapshot_write_at(fp, header.regs_offset, vm->regs, sizeof(vm->regs))
+        && snapshot_write_at(fp, header.stack_offset, vm->stack.buf, header.stack_words * sizeof(uint16_t))
+        && snapshot_write_at(fp, header.out_offset, out, out_bytes);
+
+    if (fclose(fp) != 0) {
+        ok = false;
+    }
+
+    if (!ok || rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        return SNAPSHOT_WRITE_ERROR;
+    }
+
+    return SNAPSHOT_OK;
+}
+
+SnapshotStatus snapshot_save_at_first_input(VM *vm, const char *path, const char *binary_path) {
+    uint64_t hash;
+    SnapshotStatus status = snapshot_hash_file(binary_path, &hash);
+    if (status != SNAPSHOT_OK) {
+        return status;
+    }
+
+    uint32_t out_bytes = 0;
+    uint32_t out_cap   = 1024;
+    char *out = malloc(out_cap);
+    if (out == NULL) {
+        return SNAPSHOT_ALLOCATION_FAIL_ERROR;
+    }
+
+    // NOTE: same loop as vm_process, but stop in front of the first *in* and keep a copy of everything printed
+    while (vm->status == VM_OK && !vm->halt && vm->pos < MEM_SIZE && vm->mem[vm->pos] != 20) {
+        // NOTE: same fetch as the *out* case of vm_next_inst, which prints nothing for an invalid number
+        uint16_t ch = vm->mem[vm->pos] == 19 ? vm_get_num(vm, vm->mem[vm->pos + 1]) : NO_NUM;
+        if (ch != NO_NUM) {
+            if (out_bytes == out_cap) {
+                out_cap *= 2;
+                char *newout = realloc(out, out_cap);
+                if (newout == NULL) {
+                    free(out);
+                    return SNAPSHOT_ALLOCATION_FAIL_ERROR;
+                }
+                out = newout;
+            }
+            out[out_bytes++] = (char)ch;
+        }
+        vm_next_inst(vm);
+    }
+
+    if (vm->status != VM_OK) {
+        status = SNAPSHOT_VM_ERROR;
+    } else if (vm->halt || vm->pos >= MEM_SIZE) {
+        status = SNAPSHOT_NO_INPUT_ERROR;
+    } else {
+        status = snapshot_save(vm, path, hash, out, out_bytes);
+    }
+
+    free(out);
+    return status;
+}
+
+SnapshotStatus snapshot_resume(VM *vm, const char *path, const char *binary_path) {
+    uint64_t hash;
+    SnapshotStatus status = snapshot_hash_file(binary_path, &hash);
+    if (status != SNAPSHOT_OK) {
+        return status;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return SNAPSHOT_OPEN_ERROR;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        return SNAPSHOT_BAD_HEADER_ERROR;
+    }
+
+    size_t size = (size_t)st.st_size;
+    const uint8_t *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return SNAPSHOT_MAP_ERROR;
+    }
+
+    const SnapshotHeader *header = (const SnapshotHeader *)base;
+    uint64_t end = (uint64_t)header->out_offset + header->out_bytes;
+
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0
+        || header->version != SNAPSHOT_VERSION
+        || header->header_size != sizeof(SnapshotHeader)
+        || header->mem_words != MEM_SIZE
+        || header->reg_count != REG_COUNT
+        || header->regs_offset != header->mem_offset + sizeof(uint16_t) * MEM_SIZE
+        || header->stack_offset != header->regs_offset + sizeof(vm->regs)
+        || header->out_offset != header->stack_offset + header->stack_words * sizeof(uint16_t)
+        || end > size) {
+        status = SNAPSHOT_BAD_HEADER_ERROR;
+    } else if (header->binary_hash != hash) {
+        status = SNAPSHOT_HASH_MISMATCH_ERROR;
+    }
+
+    if (status != SNAPSHOT_OK) {
+        munmap((void *)base, size);
+        return status;
+    }
+
+    vm_reset(vm);
+    memcpy(vm->mem, base + header->mem_offset, sizeof(uint16_t) * MEM_SIZE);
+    memcpy(vm->regs, base + header->regs_offset, sizeof(vm->regs));
+
+    // NOTE: vm_reset leaves the stack alone, drop whatever the vm had before pushing the saved one
+    vm->stack.index  = -1;
+    vm->stack.status = STACK_OK;
+
+    const uint16_t *stack = (const uint16_t *)(base + header->stack_offset);
+    for (uint32_t i = 0; i < header->stack_words && vm->stack.status == STACK_OK; i++) {
+        stack_push(&vm->stack, stack[i]);
+    }
+
+    vm->pos  = header->pos;
+    vm->halt = header->halt;
+
+    fwrite(base + header->out_offset, 1, header->out_bytes, stdout);
+
+    munmap((void *)base, size);
+
+    if (vm->stack.status != STACK_OK) {
+        return SNAPSHOT_ALLOCATION_FAIL_ERROR;
+    }
+    return SNAPSHOT_OK;
+}
@@ -12,13 +12,8 @@ Stack *stack_init() {
         return NULL;
     }
 
-    stack->index   = -1; 
-    stack->bufsize = 2;
-    stack->status  = STACK_OK;
-    stack->buf     = NULL;
-
-    stack->buf = malloc(sizeof(uint16_t) * stack->bufsize);
-    if (stack->buf == NULL) {
+    if (!stack_setup(stack)) {
+        free(stack);
         return NULL;
     }
 
@@ -30,11 +25,31 @@ void stack_free(Stack *stack) {
         return;
     }
 
+    stack_teardown(stack);
+    free(stack);
+}
+
+bool stack_setup(Stack *stack) {
+    stack->index   = -1; 
+    stack->peak    = -1;
+    stack->bufsize = 2;
+    stack->status  = STACK_OK;
+    stack->buf     = NULL;
+
+    stack->buf = malloc(sizeof(uint16_t) * stack->bufsize);
+    if (stack->buf == NULL) {
+        stack->status = STACK_ALLOCATION_FAIL_ERROR;
+        return false;
+    }
+
+    return true;
+}
+
+void stack_teardown(Stack *stack) {
     if (stack->buf != NULL) {
         free(stack->buf);
+        stack->buf = NULL;
     }
-
-    free(stack);
 }
 
 const char *stack_get_error_msg(Stack *stack) {
@@ -53,16 +68,19 @@ void stack_push(Stack *stack, uint16_t val) {
     }
 
     if (stack->index + 2 >= stack->bufsize) {
-        stack->bufsize *= 2;
-        void* newbuf = realloc(stack->buf, sizeof(uint16_t) * stack->bufsize); 
+        void* newbuf = realloc(stack->buf, sizeof(uint16_t) * stack->bufsize * 2); 
         if (newbuf == NULL) {
             stack->status = STACK_ALLOCATION_FAIL_ERROR;
             return;
         }
-        stack->buf = newbuf;
+        stack->buf      = newbuf;
+        stack->bufsize *= 2;
     }
 
     *((uint16_t*)stack->buf + ++stack->index) = val;
+    if (stack->index > stack->peak) {
+        stack->peak = stack->index;
+    }
 }
 
 uint16_t stack_pop(Stack *stack) {
@@ -1,5 +1,15 @@
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
 #include "../../include/vm.h"
 #include "../../include/stack.h"
+#include "../../include/hooks.h"
+#include "../../include/heatmap.h"
+#include "../../include/metrics.h"
+#include "../../include/decode.h"
+
+static_assert(offsetof(VM, regs) % CACHE_LINE == 0, "vm regs must start a cache line");
+static_assert(offsetof(VM, hooks) + sizeof(struct VmHooks *) <= offsetof(VM, regs) + CACHE_LINE, "vm hot fields must share the regs cache line");
 
 static const char *vm_error_msgs[] = {
 #define X(name, value) [name] = value,
@@ -8,20 +18,22 @@ static const char *vm_error_msgs[] = {
 };
 
 VM *vm_init(bool should_skip_on_reg_or_num_err) {
-    VM* vm = (VM*)malloc(sizeof(VM));
+    VM* vm = (VM*)aligned_alloc(CACHE_LINE, sizeof(VM));
     if (vm == NULL) {
         return NULL;
     }
 
-    vm->stack = stack_init();
-    if (vm->stack == NULL || vm->stack->status != STACK_OK) {
-        vm->status = VM_STACK_INIT_FAIL_ERROR;
-        vm_free(vm);
+    if (!stack_setup(&vm->stack)) {
+        free(vm);
         return NULL;
     }
 
     vm->should_skip_on_reg_or_num_err = should_skip_on_reg_or_num_err;
     vm->status = VM_OK;
+    vm->hooks   = NULL;
+    vm->heatmap = NULL;
+    vm->metrics = NULL;
+    vm->decoded = NULL;
     vm_reset(vm);
 
     return vm;
@@ -32,10 +44,11 @@ void vm_free(VM *vm) {
         return;
     }
 
-    if (vm->stack != NULL) {
-        stack_free(vm->stack);
-    }
-
+    vm_hooks_detach(vm);
+    vm_heatmap_detach(vm);
+    vm_metrics_detach(vm);
+    vm_decoded_detach(vm);
+    stack_teardown(&vm->stack);
     free(vm);
 }
 
@@ -57,13 +70,8 @@ void vm_reset(VM *vm) {
     vm->halt = false;
     vm->pos  = 0;
 
-    for (int i = 0; i < MEM_SIZE; i++) {
-        vm->mem[i] = 0;
-    }
-
-    for (int i = 0; i < REG_COUNT; i++) {
-        vm->regs[i] = 0;
-    }
+    memset(vm->mem, 0, sizeof(vm->mem));
+    memset(vm->regs, 0, sizeof(vm->regs));
 }
 
 void vm_load_binary(VM* vm, const char* path) {
@@ -128,21 +136,36 @@ void vm_load_test(VM* vm) {
 }
 
 uint16_t vm_get_reg(uint16_t n) {
-    if (n < 32768 || n > 32775) {
-        return NO_REG;
-    }
-    return n % MODULO;
+    // NOTE: wraps literals to >= 32768, so one unsigned compare covers both invalid ranges (compiles to cmov)
+    uint16_t reg = (uint16_t)(n - MODULO);
+    return reg < REG_COUNT ? reg : NO_REG;
 }
 
 uint16_t vm_get_num(VM* vm, uint16_t n) {
-    uint16_t reg = vm_get_reg(n);
-    if (n > 32767) {
-        if (reg == NO_REG) {
-            return NO_NUM;
-        }
-        return vm->regs[reg];
+    // NOTE: the register load is masked so it is always in bounds, and the selects are done with masks because gcc
+    //       turns the ternary form back into branches, which mispredict on mixed literal/register operands
+    uint16_t reg  = vm->regs[(n - MODULO) & (REG_COUNT - 1)];
+    uint16_t lit  = (uint16_t)-(n < MODULO);
+    uint16_t bad  = (uint16_t)-(n >= NUM_END); // NOTE: NO_NUM is all ones, so or-ing the mask is the clamp
+    return (uint16_t)((n & lit) | (reg & ~lit) | bad);
+}
+
+uint16_t vm_inst_words(uint16_t op) {
+    // NOTE: opcode word plus operands, invalid opcodes count as a single word
+    static const uint8_t arg_count[] = {0, 2, 1, 1, 3, 3, 1, 2, 2, 3, 3, 3, 3, 3, 2, 2, 2, 1, 0, 1, 1, 0};
+    return op < sizeof(arg_count) ? 1 + arg_count[op] : 1;
+}
+
+uint64_t vm_hash_mem(VM *vm, uint16_t start, uint16_t end) {
+    // NOTE: FNV-1a 64 over the little endian bytes of mem[start..end)
+    uint64_t h = 14695981039346656037ULL;
+    for (uint16_t i = start; i < end && i < MEM_SIZE; i++) {
+        h ^= (uint8_t)(vm->mem[i] & 0xff);
+        h *= 1099511628211ULL;
+        h ^= (uint8_t)(vm->mem[i] >> 8);
+        h *= 1099511628211ULL;
     }
-    return n; 
+    return h;
 }
 
 void vm_process(VM *vm) {
@@ -150,9 +173,38 @@ void vm_process(VM *vm) {
         return;
     }
 
+    // NOTE: decoded records skip heatmap_record_exec, so a recording run stays on the plain interpreter
+    bool decoded = vm->decoded != NULL && vm->heatmap == NULL;
+
+    uint64_t steps     = 0;
+    uint64_t published = 0;
     while (vm->status == VM_OK && !vm->halt && vm->pos < MEM_SIZE) {
         // printf("pos: %d, instruction: %d\n", vm->pos, vm->mem[vm->pos]);
-        vm_next_inst(vm);
+        // NOTE: *in* may block on the user for a long time, readers should see everything that ran before it
+        if (vm->metrics != NULL && vm->mem[vm->pos] == 20 && steps != published) {
+            vm_metrics_publish(vm, steps - published);
+            published = steps;
+        }
+
+        if (decoded) {
+            // NOTE: runs up to the next publish point in one call, so the decoded step loop stays in decode.c
+            steps += vm_run_decoded(vm, METRICS_PUBLISH_MASK + 1 - (steps - published));
+        } else {
+            vm_next_inst(vm);
+            steps++;
+        }
+
+        // NOTE: counted locally and published in chunks, the shared counters stay off the per instruction path
+        if (steps - published > METRICS_PUBLISH_MASK) {
+            if (vm->metrics != NULL) {
+                vm_metrics_publish(vm, steps - published);
+            }
+            published = steps;
+        }
+    }
+
+    if (vm->metrics != NULL) {
+        vm_metrics_publish(vm, steps - published);
     }
 }
 
@@ -161,6 +213,10 @@ void vm_next_inst(VM* vm) {
         return;
     }
 
+    if (vm->heatmap != NULL) {
+        heatmap_record_exec(vm->heatmap, vm->pos, vm_inst_words(vm->mem[vm->pos]));
+    }
+
     uint16_t reg, a, b, c, val;
     switch (vm->mem[vm->pos]) {
         case 0: // halt
@@ -204,8 +260,8 @@ void vm_next_inst(VM* vm) {
                 return;
             }
 
-            stack_push(vm->stack, a);
-            if (vm->stack->status != STACK_OK) {
+            stack_push(&vm->stack, a);
+            if (vm->stack.status != STACK_OK) {
                 if (vm->should_skip_on_reg_or_num_err) {
                     vm->status = VM_STACK_PUSH_FAIL_ERROR;
                     vm->halt = true;
@@ -228,8 +284,8 @@ void vm_next_inst(VM* vm) {
                 return;
             }
 
-            val = stack_pop(vm->stack);
-            if (vm->stack->status != STACK_OK) {
+            val = stack_pop(&vm->stack);
+            if (vm->stack.status != STACK_OK) {
                 if (vm->should_skip_on_reg_or_num_err) {
                     vm->halt = true;
                     vm->status = VM_STACK_POP_FAIL_ERROR;
@@ -549,6 +605,9 @@ void vm_next_inst(VM* vm) {
             }
 
             vm->regs[reg] = vm->mem[b];
+            if (vm->heatmap != NULL) {
+                heatmap_mark(vm->heatmap, HEATMAP_READ, b);
+            }
             vm->pos += 3;
             break;
         case 16: // wmem
@@ -566,6 +625,15 @@ void vm_next_inst(VM* vm) {
             }
 
             vm->mem[a] = b;
+            if (vm->hooks != NULL) {
+                vm_hooks_guard_write(vm, a);
+            }
+            if (vm->heatmap != NULL) {
+                heatmap_mark(vm->heatmap, HEATMAP_WRITE, a);
+            }
+            if (vm->decoded != NULL) {
+                vm_decoded_invalidate(vm, a);
+            }
             vm->pos += 3;
             break;
         case 17: // call
@@ -581,8 +649,13 @@ void vm_next_inst(VM* vm) {
                 return;
             }
 
-            stack_push(vm->stack, vm->pos + 2);
-            if (vm->stack->status != STACK_OK) {
+            if (vm->hooks != NULL && vm_hooks_call(vm, a)) {
+                vm->pos += 2;
+                break;
+            }
+
+            stack_push(&vm->stack, vm->pos + 2);
+            if (vm->stack.status != STACK_OK) {
                 if (vm->should_skip_on_reg_or_num_err) {
                     vm->halt = true;
                     vm->status = VM_STACK_PUSH_FAIL_ERROR;
@@ -595,8 +668,8 @@ void vm_next_inst(VM* vm) {
             vm->pos = a;
             break;
         case 18: // ret
-            val = stack_pop(vm->stack);
-            if (vm->stack->status != STACK_OK) {
+            val = stack_pop(&vm->stack);
+            if (vm->stack.status != STACK_OK) {
                 if (vm->should_skip_on_reg_or_num_err) {
                     vm->halt = true;
                     vm->status = VM_STACK_POP_FAIL_ERROR;
@@ -622,6 +695,9 @@ void vm_next_inst(VM* vm) {
             }
 
             fprintf(stdout, "%c", a);
+            if (vm->metrics != NULL) {
+                vm_metrics_count_out(vm);
+            }
             vm->pos += 2;
             break;
         case 20: // in
@@ -638,7 +714,15 @@ void vm_next_inst(VM* vm) {
             }
 
             char ch;
-            fscanf(stdin, "%1c", &ch);
+            uint64_t blocked_since = vm->metrics != NULL ? metrics_now_ns() : 0;
+            bool got = fscanf(stdin, "%1c", &ch) == 1;
+            if (vm->metrics != NULL) {
+                vm_metrics_count_in(vm, blocked_since, got);
+            }
+            if (!got) { // NOTE: input is over, stop instead of feeding garbage
+                vm->halt = true;
+                return;
+            }
 
             vm->regs[reg] = (uint16_t)ch;
             vm->pos += 2;
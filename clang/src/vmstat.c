@@ -0,0 +1,85 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "../include/metrics.h"
+
+void usage(const char *prog) {
+    printf("usage: %s <metrics file> [--once] [--interval <seconds>]\n", prog);
+}
+
+typedef struct {
+    uint64_t updated_ns;
+    uint64_t instructions;
+} Sample;
+
+Sample print_metrics(VmMetrics *metrics, Sample prev) {
+    uint64_t started      = atomic_load_explicit(&metrics->started_ns, memory_order_relaxed);
+    uint64_t updated      = atomic_load_explicit(&metrics->updated_ns, memory_order_relaxed);
+    uint64_t instructions = atomic_load_explicit(&metrics->instructions, memory_order_relaxed);
+
+    double elapsed = (double)(updated - started) / 1e9;
+    double window  = (double)(updated - prev.updated_ns) / 1e9;
+
+    // NOTE: plain "key value" lines, a blank line ends each sample
+    printf("pid %u\n", metrics->pid);
+    printf("running %u\n", atomic_load_explicit(&metrics->running, memory_order_relaxed));
+    printf("uptime_s %.3f\n", elapsed);
+    printf("instructions %lu\n", (unsigned long)instructions);
+    printf("mips %.3f\n", window > 0 ? (double)(instructions - prev.instructions) / window / 1e6 : 0.0);
+    printf("mips_avg %.3f\n", elapsed > 0 ? (double)instructions / elapsed / 1e6 : 0.0);
+    printf("stack_depth %lu\n", (unsigned long)atomic_load_explicit(&metrics->stack_depth, memory_order_relaxed));
+    printf("stack_peak %lu\n", (unsigned long)atomic_load_explicit(&metrics->stack_peak, memory_order_relaxed));
+    printf("in_bytes %lu\n", (unsigned long)atomic_load_explicit(&metrics->in_bytes, memory_order_relaxed));
+    printf("out_bytes %lu\n", (unsigned long)atomic_load_explicit(&metrics->out_bytes, memory_order_relaxed));
+    printf("in_blocked_s %.3f\n", (double)atomic_load_explicit(&metrics->in_blocked_ns, memory_order_relaxed) / 1e9);
+    printf("\n");
+    fflush(stdout);
+
+    Sample sample = {updated, instructions};
+    return sample;
+}
+
+int main(int argc, char **argv) {
+    const char *path     = NULL;
+    bool        once     = false;
+    unsigned    interval = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--once") == 0) {
+            once = true;
+        } else if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc) {
+            interval = (unsigned)atoi(argv[++i]);
+        } else if (path == NULL) {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (path == NULL || interval == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    VmMetrics *metrics = metrics_open(path);
+    if (metrics == NULL) {
+        printf("cannot open metrics file: %s\n", path);
+        return 1;
+    }
+
+    // NOTE: the first sample's mips covers the whole run, later ones only the last interval
+    Sample prev = {atomic_load_explicit(&metrics->started_ns, memory_order_relaxed), 0};
+    for (;;) {
+        prev = print_metrics(metrics, prev);
+        if (once || !atomic_load_explicit(&metrics->running, memory_order_relaxed)) {
+            break;
+        }
+        sleep(interval);
+    }
+
+    metrics_close(metrics);
+    return 0;
+}
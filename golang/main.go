@@ -4,6 +4,7 @@ import (
 	"io"
 	"os"
 	"fmt"
+	"flag"
 	"vm/vm"
 )
 
@@ -28,6 +29,18 @@ func loadBin() *[]byte {
 }
 
 func main() {
+	fast := flag.Bool("fast", false, "run on the allocation free engine (vm.FastVM)")
+	flag.Parse()
+
+	if *fast {
+		machine := vm.NewFastVM(os.Stdin, os.Stdout)
+		machine.LoadBinary(*loadBin())
+		if err := machine.Run(); err != nil && err != io.EOF {
+			handleErr(err)
+		}
+		return
+	}
+
 	machine := vm.NewVM()
 	machine.LoadBinary(loadBin())
 	// machine.LoadTest()
@@ -0,0 +1,394 @@
+package vm
+
+import (
+	"bufio"
+	"errors"
+	"io"
+)
+
+const (
+	fastRegBase = 32768
+	fastNoNum   = fastRegBase + 8 // NOTE: slot every invalid number is clamped to
+	fastInvalid = 0xffff
+	fastOpCount = 22
+
+	// NOTE: deep enough for challenge.bin, Push only grows past this on runaway recursion
+	FastStackSize = 1 << 12
+)
+
+var (
+	ErrInvalidInstruction = errors.New("Invalid Instruction")
+)
+
+// FastVM is an allocation free engine for embedding, it keeps the semantics of VM (invalid operands skip the
+// instruction) but dispatches through a table, reports errors once through Err and buffers all I/O.
+type FastVM struct {
+	// NOTE: [0..32767] literals map to themselves, [32768..32775] are the registers, [32776] holds fastInvalid
+	vals  [fastNoNum + 1]uint16
+	mem   [32768]uint16
+	stack []uint16
+	pos   uint16
+	halt  bool
+	err   error
+	in    *bufio.Reader
+	out   *bufio.Writer
+	steps uint64
+}
+
+type fastOp func(vm *FastVM)
+
+var fastOps [fastOpCount]fastOp
+
+func init() {
+	fastOps = [fastOpCount]fastOp{
+		(*FastVM).opHalt, (*FastVM).opSet, (*FastVM).opPush, (*FastVM).opPop,
+		(*FastVM).opEq, (*FastVM).opGt, (*FastVM).opJmp, (*FastVM).opJt,
+		(*FastVM).opJf, (*FastVM).opAdd, (*FastVM).opMult, (*FastVM).opMod,
+		(*FastVM).opAnd, (*FastVM).opOr, (*FastVM).opNot, (*FastVM).opRmem,
+		(*FastVM).opWmem, (*FastVM).opCall, (*FastVM).opRet, (*FastVM).opOut,
+		(*FastVM).opIn, (*FastVM).opNoop,
+	}
+}
+
+func NewFastVM(in io.Reader, out io.Writer) *FastVM {
+	vm := FastVM{}
+	vm.stack = make([]uint16, 0, FastStackSize)
+	vm.in = bufio.NewReader(in)
+	vm.out = bufio.NewWriter(out)
+	vm.Reset()
+	return &vm
+}
+
+// Reset clears memory, registers and the stack, the I/O buffers are left alone (see SetIO).
+func (vm *FastVM) Reset() {
+	for i := 0; i < fastRegBase; i++ {
+		vm.vals[i] = uint16(i)
+	}
+	for i := fastRegBase; i < fastNoNum; i++ {
+		vm.vals[i] = 0
+	}
+	vm.vals[fastNoNum] = fastInvalid
+
+	// NOTE: fill memory with noop instruction, same as VM.ResetMemory
+	for i := range vm.mem {
+		vm.mem[i] = uint16(21)
+	}
+
+	vm.stack = vm.stack[:0]
+	vm.pos = 0
+	vm.halt = false
+	vm.err = nil
+	vm.steps = 0
+}
+
+func (vm *FastVM) SetIO(in io.Reader, out io.Writer) {
+	vm.in.Reset(in)
+	vm.out.Reset(out)
+}
+
+func (vm *FastVM) LoadBinary(bin []byte) {
+	n := min(len(bin)/2, len(vm.mem))
+	bin = bin[:2*n]
+	mem := vm.mem[:n]
+	for i := range mem {
+		mem[i] = uint16(bin[2*i]) | uint16(bin[2*i+1])<<8
+	}
+}
+
+func (vm *FastVM) SetMemory(mem []uint16) {
+	copy(vm.mem[:], mem)
+}
+
+func (vm *FastVM) SetReg(reg int, val uint16) {
+	vm.vals[fastRegBase+reg] = val
+}
+
+func (vm *FastVM) Reg(reg int) uint16 {
+	return vm.vals[fastRegBase+reg]
+}
+
+func (vm *FastVM) Halted() bool {
+	return vm.halt
+}
+
+// Err is the error that stopped the machine, io.EOF when input ran out, nil after a halt instruction.
+func (vm *FastVM) Err() error {
+	return vm.err
+}
+
+func (vm *FastVM) Steps() uint64 {
+	return vm.steps
+}
+
+// Run executes until the machine halts or runs off the end of memory, output is flushed before returning.
+func (vm *FastVM) Run() error {
+	for !vm.halt {
+		vm.step()
+	}
+	vm.Flush()
+	return vm.err
+}
+
+// RunSteps executes at most n instructions and returns how many ran, output stays buffered.
+func (vm *FastVM) RunSteps(n int) int {
+	start := vm.steps
+	for i := 0; i < n && !vm.halt; i++ {
+		vm.step()
+	}
+	return int(vm.steps - start)
+}
+
+func (vm *FastVM) Flush() {
+	if err := vm.out.Flush(); err != nil && vm.err == nil {
+		vm.err = err
+		vm.halt = true
+	}
+}
+
+func (vm *FastVM) step() {
+	// NOTE: a jmp/ret past the last word or falling off the end stops the machine like VM.Process does
+	if int(vm.pos) >= len(vm.mem) {
+		vm.halt = true
+		return
+	}
+
+	op := vm.mem[vm.pos]
+	if op >= fastOpCount {
+		vm.fail(ErrInvalidInstruction)
+		return
+	}
+	vm.steps++
+	fastOps[op](vm)
+}
+
+func (vm *FastVM) fail(err error) {
+	vm.err = err
+	vm.halt = true
+}
+
+// NOTE: operand words past the end of memory read as fastInvalid instead of panicking
+func (vm *FastVM) arg(i uint16) uint16 {
+	p := int(vm.pos) + int(i)
+	if p >= len(vm.mem) {
+		return fastInvalid
+	}
+	return vm.mem[p]
+}
+
+func (vm *FastVM) num(i uint16) uint16 {
+	n := vm.arg(i)
+	if n > fastNoNum {
+		n = fastNoNum
+	}
+	return vm.vals[n]
+}
+
+// NOTE: index into vals for a register operand, 0 (a literal slot) when it is not a register
+func (vm *FastVM) reg(i uint16) int {
+	r := vm.arg(i) - fastRegBase
+	if r >= 8 {
+		return 0
+	}
+	return fastRegBase + int(r)
+}
+
+func (vm *FastVM) push(val uint16) {
+	vm.stack = append(vm.stack, val)
+}
+
+func (vm *FastVM) opHalt() {
+	vm.halt = true
+	vm.pos += 1
+}
+
+func (vm *FastVM) opSet() {
+	reg, b := vm.reg(1), vm.num(2)
+	if reg != 0 && b != fastInvalid {
+		vm.vals[reg] = b
+	}
+	vm.pos += 3
+}
+
+func (vm *FastVM) opPush() {
+	if a := vm.num(1); a != fastInvalid {
+		vm.push(a)
+	}
+	vm.pos += 2
+}
+
+func (vm *FastVM) opPop() {
+	reg := vm.reg(1)
+	vm.pos += 2
+	if reg == 0 {
+		return
+	}
+	if len(vm.stack) == 0 {
+		vm.fail(ErrStackEmpty)
+		return
+	}
+	vm.vals[reg] = vm.stack[len(vm.stack)-1]
+	vm.stack = vm.stack[:len(vm.stack)-1]
+}
+
+func flag(ok bool) uint16 {
+	if ok {
+		return 1
+	}
+	return 0
+}
+
+func (vm *FastVM) opEq() {
+	reg, b, c := vm.reg(1), vm.num(2), vm.num(3)
+	if reg != 0 && b != fastInvalid && c != fastInvalid {
+		vm.vals[reg] = flag(b == c)
+	}
+	vm.pos += 4
+}
+
+func (vm *FastVM) opGt() {
+	reg, b, c := vm.reg(1), vm.num(2), vm.num(3)
+	if reg != 0 && b != fastInvalid && c != fastInvalid {
+		vm.vals[reg] = flag(b > c)
+	}
+	vm.pos += 4
+}
+
+func (vm *FastVM) opJmp() {
+	a := vm.num(1)
+	if a == fastInvalid {
+		vm.pos += 2
+		return
+	}
+	vm.pos = a
+}
+
+func (vm *FastVM) opJt() {
+	a, b := vm.num(1), vm.num(2)
+	if a == fastInvalid || b == fastInvalid || a == 0 {
+		vm.pos += 3
+		return
+	}
+	vm.pos = b
+}
+
+func (vm *FastVM) opJf() {
+	a, b := vm.num(1), vm.num(2)
+	if a == fastInvalid || b == fastInvalid || a != 0 {
+		vm.pos += 3
+		return
+	}
+	vm.pos = b
+}
+
+func (vm *FastVM) opAdd() {
+	reg, b, c := vm.reg(1), vm.num(2), vm.num(3)
+	if reg != 0 && b != fastInvalid && c != fastInvalid {
+		vm.vals[reg] = (b + c) % MODULO
+	}
+	vm.pos += 4
+}
+
+func (vm *FastVM) opMult() {
+	reg, b, c := vm.reg(1), vm.num(2), vm.num(3)
+	if reg != 0 && b != fastInvalid && c != fastInvalid {
+		vm.vals[reg] = (b * c) % MODULO
+	}
+	vm.pos += 4
+}
+
+func (vm *FastVM) opMod() {
+	reg, b, c := vm.reg(1), vm.num(2), vm.num(3)
+	if reg != 0 && b != fastInvalid && c != fastInvalid {
+		vm.vals[reg] = b % c
+	}
+	vm.pos += 4
+}
+
+func (vm *FastVM) opAnd() {
+	reg, b, c := vm.reg(1), vm.num(2), vm.num(3)
+	if reg != 0 && b != fastInvalid && c != fastInvalid {
+		vm.vals[reg] = (b & c) % MODULO
+	}
+	vm.pos += 4
+}
+
+func (vm *FastVM) opOr() {
+	reg, b, c := vm.reg(1), vm.num(2), vm.num(3)
+	if reg != 0 && b != fastInvalid && c != fastInvalid {
+		vm.vals[reg] = (b | c) % MODULO
+	}
+	vm.pos += 4
+}
+
+func (vm *FastVM) opNot() {
+	reg, b := vm.reg(1), vm.num(2)
+	if reg != 0 && b != fastInvalid {
+		vm.vals[reg] = (^b) % MODULO
+	}
+	vm.pos += 3
+}
+
+func (vm *FastVM) opRmem() {
+	reg, b := vm.reg(1), vm.num(2)
+	if reg != 0 && b != fastInvalid {
+		vm.vals[reg] = vm.mem[b%MODULO]
+	}
+	vm.pos += 3
+}
+
+func (vm *FastVM) opWmem() {
+	a, b := vm.num(1), vm.num(2)
+	if a != fastInvalid && b != fastInvalid {
+		vm.mem[a%MODULO] = b
+	}
+	vm.pos += 3
+}
+
+func (vm *FastVM) opCall() {
+	a := vm.num(1)
+	if a == fastInvalid {
+		vm.pos += 2
+		return
+	}
+	vm.push(vm.pos + 2)
+	vm.pos = a
+}
+
+func (vm *FastVM) opRet() {
+	if len(vm.stack) == 0 {
+		vm.pos += 1
+		vm.fail(ErrStackEmpty)
+		return
+	}
+	vm.pos = vm.stack[len(vm.stack)-1]
+	vm.stack = vm.stack[:len(vm.stack)-1]
+}
+
+func (vm *FastVM) opOut() {
+	if a := vm.num(1); a != fastInvalid {
+		vm.out.WriteByte(byte(a))
+	}
+	vm.pos += 2
+}
+
+func (vm *FastVM) opIn() {
+	reg := vm.reg(1)
+	if reg == 0 {
+		vm.pos += 2
+		return
+	}
+
+	// NOTE: whoever is on the other end should see the prompt before we block
+	vm.Flush()
+	ch, err := vm.in.ReadByte()
+	if err != nil {
+		vm.fail(err)
+		return
+	}
+	vm.vals[reg] = uint16(ch)
+	vm.pos += 2
+}
+
+func (vm *FastVM) opNoop() {
+	vm.pos += 1
+}
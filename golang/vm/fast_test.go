@@ -0,0 +1,228 @@
+package vm
+
+import (
+	"bytes"
+	"io"
+	"os"
+	"slices"
+	"testing"
+)
+
+// NOTE: r0 counts up while every iteration goes through call/ret, push/pop and out:
+//
+//	0: call 6, 2: jmp 0, 4: noop noop, 6: push r0, 8: add r0 r0 1, 12: out 'A', 14: pop r1, 16: ret
+var benchLoop = []uint16{17, 6, 6, 0, 21, 21, 2, 32768, 9, 32768, 32768, 1, 19, 65, 3, 32769, 18}
+
+// NOTE: every opcode except halt and in, an invalid register operand and a wmem into its own code, the outer loop
+// never ends so both engines are compared after a fixed number of steps
+var mixedProgram = []uint16{
+	1, 32768, 7, //  0: set r0 7
+	1, 32769, 100, //  3: set r1 100
+	2, 32768, //  6: push r0
+	17, 44, //  8: call 44
+	3, 32770, // 10: pop r2
+	9, 32771, 32771, 32770, // 12: add r3 r3 r2
+	10, 32772, 32771, 3, // 16: mult r4 r3 3
+	11, 32773, 32772, 1000, // 20: mod r5 r4 1000
+	16, 34, 32773, // 24: wmem 34 r5 (the literal of the or below)
+	21,          // 27: noop
+	1, 32776, 5, // 28: set <invalid> 5, skipped
+	13, 32774, 32774, 0, // 31: or r6 r6 <patched>
+	9, 32769, 32769, 32767, // 35: add r1 r1 32767 (r1 - 1)
+	7, 32769, 6, // 39: jt r1 6
+	6, 0, // 42: jmp 0
+	9, 32768, 32768, 32774, // 44: add r0 r0 r6
+	5, 32775, 32768, 3, // 48: gt r7 r0 3
+	14, 32770, 32768, // 52: not r2 r0
+	15, 32770, 34, // 55: rmem r2 34
+	8, 32775, 71, // 58: jf r7 71
+	12, 32770, 32770, 63, // 61: and r2 r2 63
+	9, 32770, 32770, 48, // 65: add r2 r2 48 (printable)
+	19, 32770, // 69: out r2
+	19, 10, // 71: out '\n'
+	4, 32775, 32770, 50, // 73: eq r7 r2 50
+	18, // 77: ret
+}
+
+// NOTE: VM prints straight to os.Stdout, swap it for a pipe while f runs
+func captureStdout(t testing.TB, f func()) []byte {
+	r, w, err := os.Pipe()
+	if err != nil {
+		t.Fatal(err)
+	}
+	stdout := os.Stdout
+	os.Stdout = w
+
+	done := make(chan []byte)
+	go func() {
+		out, _ := io.ReadAll(r)
+		done <- out
+	}()
+
+	f()
+	os.Stdout = stdout
+	w.Close()
+	return <-done
+}
+
+func compareEngines(t *testing.T, mem []uint16, steps int) {
+	old := NewVM()
+	old.SetMemory(mem)
+	oldOut := captureStdout(t, func() {
+		for i := 0; i < steps && !old.halt; i++ {
+			if err := old.next(); err != nil {
+				t.Fatalf("VM stopped at step %d: %v", i, err)
+			}
+		}
+	})
+
+	var fastOut bytes.Buffer
+	fast := NewFastVM(bytes.NewReader(nil), &fastOut)
+	fast.SetMemory(mem)
+	if n := fast.RunSteps(steps); n != steps {
+		t.Fatalf("FastVM ran %d of %d steps: %v", n, steps, fast.Err())
+	}
+	fast.Flush()
+
+	if old.pos != fast.pos {
+		t.Errorf("pos: VM %d, FastVM %d", old.pos, fast.pos)
+	}
+	for r := range old.regs {
+		if old.regs[r] != fast.Reg(r) {
+			t.Errorf("r%d: VM %d, FastVM %d", r, old.regs[r], fast.Reg(r))
+		}
+	}
+	if !slices.Equal(old.stack.data, fast.stack) {
+		t.Errorf("stack: VM %v, FastVM %v", old.stack.data, fast.stack)
+	}
+	if old.mem != fast.mem {
+		t.Errorf("memory differs")
+	}
+	if !bytes.Equal(oldOut, fastOut.Bytes()) {
+		t.Errorf("output differs: VM %d bytes, FastVM %d bytes", len(oldOut), fastOut.Len())
+	}
+}
+
+func TestFastVMMatchesVM(t *testing.T) {
+	compareEngines(t, mixedProgram, 200000)
+	compareEngines(t, benchLoop, 100000)
+}
+
+func TestFastVMMatchesVMChallengeBoot(t *testing.T) {
+	bin, err := os.ReadFile("../../data/challenge.bin")
+	if err != nil {
+		t.Skip(err)
+	}
+
+	// NOTE: stops short of the first *in*, where VM would read os.Stdin
+	mem := make([]uint16, len(bin)/2)
+	for i := range mem {
+		mem[i] = uint16(bin[2*i]) | uint16(bin[2*i+1])<<8
+	}
+	compareEngines(t, mem, 700000)
+}
+
+func TestFastVMStopsAtEndOfMemory(t *testing.T) {
+	// NOTE: jmp to the last word (a noop), then fall off the end
+	vm := NewFastVM(bytes.NewReader(nil), io.Discard)
+	vm.SetMemory([]uint16{6, 32767})
+	if err := vm.Run(); err != nil || !vm.Halted() {
+		t.Fatalf("Run: err %v, halted %v", err, vm.Halted())
+	}
+
+	// NOTE: jmp to a value past memory
+	vm.Reset()
+	vm.SetReg(0, 40000)
+	vm.SetMemory([]uint16{6, 32768})
+	if n := vm.RunSteps(10); n != 1 || !vm.Halted() || vm.Err() != nil {
+		t.Fatalf("RunSteps: %d steps, halted %v, err %v", n, vm.Halted(), vm.Err())
+	}
+}
+
+// NOTE: VM prints with fmt.Printf, send os.Stdout to /dev/null for the benchmarks
+func discardStdout(b *testing.B) {
+	devnull, err := os.OpenFile(os.DevNull, os.O_WRONLY, 0)
+	if err != nil {
+		b.Fatal(err)
+	}
+	stdout := os.Stdout
+	os.Stdout = devnull
+	b.Cleanup(func() {
+		os.Stdout = stdout
+		devnull.Close()
+	})
+}
+
+func BenchmarkFastVMLoop(b *testing.B) {
+	vm := NewFastVM(bytes.NewReader(nil), io.Discard)
+	vm.SetMemory(benchLoop)
+	b.ReportAllocs()
+	b.ResetTimer()
+
+	// NOTE: one benchmark op is one guest instruction, so allocs/op is allocations per instruction
+	vm.RunSteps(b.N)
+	vm.Flush()
+}
+
+func BenchmarkVMLoop(b *testing.B) {
+	discardStdout(b)
+	vm := NewVM()
+	vm.SetMemory(benchLoop)
+	b.ReportAllocs()
+	b.ResetTimer()
+
+	for i := 0; i < b.N; i++ {
+		vm.next()
+	}
+}
+
+func BenchmarkFastVMChallengeBoot(b *testing.B) {
+	bin, err := os.ReadFile("../../data/challenge.bin")
+	if err != nil {
+		b.Skip(err)
+	}
+
+	vm := NewFastVM(bytes.NewReader(nil), io.Discard)
+	input := bytes.NewReader(nil)
+	b.ReportAllocs()
+	b.ResetTimer()
+
+	// NOTE: one op is a full boot up to the first prompt, input is empty so *in* stops the machine with io.EOF
+	var steps uint64
+	for i := 0; i < b.N; i++ {
+		vm.Reset()
+		input.Reset(nil)
+		vm.SetIO(input, io.Discard)
+		vm.LoadBinary(bin)
+		if err := vm.Run(); err != io.EOF {
+			b.Fatalf("boot ended with %v", err)
+		}
+		steps += vm.Steps()
+	}
+	b.ReportMetric(float64(b.Elapsed().Nanoseconds())/float64(steps), "ns/inst")
+}
+
+func BenchmarkVMChallengeBoot(b *testing.B) {
+	bin, err := os.ReadFile("../../data/challenge.bin")
+	if err != nil {
+		b.Skip(err)
+	}
+
+	discardStdout(b)
+	b.ReportAllocs()
+	b.ResetTimer()
+
+	// NOTE: same boot as BenchmarkFastVMChallengeBoot, stopping before the first *in* since VM reads os.Stdin
+	var steps uint64
+	for i := 0; i < b.N; i++ {
+		vm := NewVM()
+		vm.LoadBinary(&bin)
+		for vm.mem[vm.pos] != 20 {
+			if err := vm.next(); err != nil {
+				b.Fatalf("boot ended with %v", err)
+			}
+			steps++
+		}
+	}
+	b.ReportMetric(float64(b.Elapsed().Nanoseconds())/float64(steps), "ns/inst")
+}